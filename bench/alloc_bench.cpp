@@ -0,0 +1,172 @@
+/*
+ *  Counts the heap allocations of Thompson's and Glushkov's constructions
+ *  on a random regex, with their scratch on the heap and in the arena of
+ *  a compilation, built and run by `make bench`.
+ *
+ *  usage: alloc_bench [<symbols>] [<seed>]
+ */
+
+#include <cstdlib>
+#include <new>
+
+#define main rtd_main
+#include "../main.cpp"
+#undef main
+
+static usize num_allocations = 0;
+static usize num_bytes = 0;
+
+/* Every allocation of the standard library goes through these, aligned or not */
+static void*
+count_allocation(const size_t size, const size_t alignment)
+{
+    ++num_allocations;
+    num_bytes += size;
+    void* p = aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (!p)
+        abort();
+    return p;
+}
+
+/* Out of line, or GCC pairs the free with the operator new of the inlined caller */
+[[gnu::noinline]] static void
+release(void* p) noexcept
+{
+    free(p);
+}
+
+void*
+operator new(const size_t size)
+{
+    return count_allocation(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void*
+operator new(const size_t size, const std::align_val_t alignment)
+{
+    return count_allocation(size, std::max(size_t(alignment), sizeof(void*)));
+}
+
+void
+operator delete(void* p) noexcept
+{
+    release(p);
+}
+
+void
+operator delete(void* p, size_t) noexcept
+{
+    release(p);
+}
+
+void
+operator delete(void* p, std::align_val_t) noexcept
+{
+    release(p);
+}
+
+void
+operator delete(void* p, size_t, std::align_val_t) noexcept
+{
+    release(p);
+}
+
+static u64
+next_random(u64& state)
+{
+    /* xorshift64 */
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+static void
+append_regex(std::string& regex, const usize num_symbols, u64& state)
+{
+    /* A random regex of this many symbols, split at random in concatenations and unions */
+    if (num_symbols == 1) {
+        regex += DEFAULT_ALPHABET[next_random(state) % (sizeof(DEFAULT_ALPHABET) - 1)];
+    } else {
+        const usize left = 1 + next_random(state) % (num_symbols - 1);
+        const bool is_union = next_random(state) % 4 == 0;
+        regex += '(';
+        append_regex(regex, left, state);
+        if (is_union)
+            regex += '|';
+        append_regex(regex, num_symbols - left, state);
+        regex += ')';
+    }
+
+    if (next_random(state) % 8 == 0)
+        regex += "*+?"[next_random(state) % 3];
+}
+
+template<typename F>
+static void
+measure(const char* name, F&& construct)
+{
+    const usize allocations = num_allocations;
+    const usize bytes = num_bytes;
+    const auto begin_time = std::chrono::steady_clock::now();
+    const Graph g = construct();
+    const std::chrono::duration<double, std::milli> time =
+        std::chrono::steady_clock::now() - begin_time;
+
+    printf("%-16s %12zu %14zu %10.1f ms %10zu states\n",
+           name,
+           num_allocations - allocations,
+           num_bytes - bytes,
+           time.count(),
+           num_states(g));
+}
+
+int
+main(int argc, char* argv[])
+{
+    const usize size = argc > 1 ? usize(strtoull(argv[1], nullptr, 10)) : 100000;
+    u64 state = argc > 2 ? strtoull(argv[2], nullptr, 10) | 1 : 0x9e3779b97f4a7c15;
+    if (size == 0) {
+        fprintf(stderr, "usage: alloc_bench [<symbols>] [<seed>]\n");
+        return EXIT_FAILURE;
+    }
+
+    std::string regex;
+    append_regex(regex, size, state);
+
+    /* The AST is built as compile_regex does, outside of the measures */
+    std::pmr::monotonic_buffer_resource ast_arena;
+    Parser parser{.regex = regex,
+                  .alphabet = DEFAULT_ALPHABET,
+                  .nodes = std::pmr::vector<RegexNode>(&ast_arena)};
+    if (!rtd::parse_regex(parser)) {
+        fprintf(stderr, "Regex is invalid at position %zu: %s\n", parser.pos, parser.error);
+        return EXIT_FAILURE;
+    }
+    const auto ast = simplify_regex(parser.nodes, &ast_arena);
+
+    printf("NFA construction of a regex of %zu symbols (%zu bytes, %zu nodes)\n\n",
+           size,
+           regex.size(),
+           ast.size());
+    printf("%-16s %12s %14s %13s\n", "", "allocations", "bytes", "time");
+
+    /* Without the arena, every allocation of the scratch goes to the heap */
+    const usize arena_size = 16 * (regex.size() + 1) * sizeof(Edge);
+    measure("thompson, heap", [&] {
+        return get_nfa_graph(ast, std::pmr::new_delete_resource());
+    });
+    measure("thompson, arena", [&] {
+        std::pmr::monotonic_buffer_resource arena(arena_size);
+        return get_nfa_graph(ast, &arena);
+    });
+    measure("glushkov, heap", [&] {
+        return get_glushkov_graph(ast, std::pmr::new_delete_resource());
+    });
+    measure("glushkov, arena", [&] {
+        std::pmr::monotonic_buffer_resource arena(arena_size);
+        return get_glushkov_graph(ast, &arena);
+    });
+
+    return EXIT_SUCCESS;
+}
@@ -3,28 +3,53 @@
 #include <array>
 #include <vector>
 #include <string>
-#include <stack>
-#include <queue>
-#include <unordered_set>
-#include <unordered_map>
+#include <span>
+#include <deque>
 #include <set>
 #include <ranges>
 #include <algorithm>
 #include <numeric>
+#include <utility>
+#include <bit>
 #include <optional>
+#include <memory_resource>
 #include <charconv>
 #include <cassert>
 #include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "regex.hpp"
 
 /* Typedefs */
 /* clang-format off */
 using u8    = uint8_t;
 using u32   = uint32_t;
+using u64   = uint64_t;
 using usize = size_t;
+using JitMatchFn = int (*)(const u8*, const u8*);
+using NodeKind    = rtd::NodeKind;
+using RegexNode   = rtd::RegexNode;
+using Parser      = rtd::Parser<std::pmr::vector<RegexNode>>;
+using NFAFragment = rtd::NFAFragment;
+using Edge        = rtd::Edge;
 
 /* Namespace aliases */
 namespace ranges = std::ranges;
+using rtd::S_LAMBDA;
+using rtd::MAX_NESTING;
 
 /* Macros */
 #define DEFAULT_ALPHABET    "abcdefghijklmnopqrstuvwxyz"
@@ -33,23 +58,50 @@ namespace ranges = std::ranges;
 #define FINAL_COLOR         "x11green"
 #define START_FINAL_COLOR   START_COLOR ":" FINAL_COLOR
 #define FONT                "monospace"
-#define S_LAMBDA            '\0'
-#define OP_CONCAT           '.'
-#define OP_UNION            '|'
-#define OP_KLEENE           '*'
-#define OP_PLUS             '+'
-#define OP_OPT              '?'
-#define IS_UNARY(x)         (x == OP_KLEENE || x == OP_PLUS || x == OP_OPT)
 #define NUM_CHARS           (1 << 8)
 #define LAMBDA_UTF          {char(0xce), char(0xbb)}
+#define WORD_BITS           64
+#define BITSET_WORDS(n)     (((n) + WORD_BITS - 1) / WORD_BITS)
+#define EMPTY_SLOT          usize(-1)
+#define NO_TERM             u32(-1)
+#define EMPTY_TERM          u32(0)
+#define EPSILON_TERM        u32(1)
+#define BITSET_SET(bs, i)   ((bs)[(i) / WORD_BITS] |= u64(1) << ((i) % WORD_BITS))
+#define UNKNOWN_STATE       u32(-1)
+#define DEAD_STATE          u32(-2)
+#define LAZY_CACHE_BYTES    (usize(1) << 20)
+#define NUM_SHARDS          usize(64)
+#define DFA_FILE_MAGIC      u32(0x46445452) /* "RTDF" when written in little-endian */
+#define DFA_FILE_VERSION    u32(2) /* Version 2 added the key of cache entries */
+#define SCAN_BLOCK_BYTES    (usize(1) << 22)
+#define MAX_LITERAL         usize(64)
+#define PREFILTER_WINDOW    (usize(1) << 20)
+#define SCAN_CHUNK_BYTES    (usize(1) << 24)
+#define CONVERGE_BYTES      (usize(1) << 16)
+#define CONVERGE_STEP       usize(64)
+#define SCAN_OUTPUT_BYTES   (usize(1) << 20)
 
 /* Enums */
-enum class TokenType : u8 {
-    REGULAR = 0,
-    OPERATOR,
-    LEFT_PAREN,
-    RIGHT_PAREN,
-    ERROR,
+enum class Construction : u8 {
+    THOMPSON = 0,
+    GLUSHKOV,
+    DERIVATIVE,
+};
+
+enum class OutputFormat : u8 {
+    TEXT = 0,
+    DOT,
+    C,
+    BIN,
+};
+
+enum class TermKind : u8 {
+    EMPTY = 0,
+    EPSILON,
+    SYMBOL,
+    CONCAT,
+    UNION,
+    STAR,
 };
 
 enum GraphNodeFlag : u32 {
@@ -60,22 +112,288 @@ enum GraphNodeFlag : u32 {
 /* clang-format on */
 
 /* Structs */
-struct NFAFragment {
-    usize start;
-    usize finish;
+struct GlushkovFragment {
+    bool nullable;
+    std::pmr::vector<usize> first;
+    std::pmr::vector<usize> last;
 };
 
 struct Transition {
     constexpr auto operator<=>(const Transition&) const = default;
 
-    usize dest;
+    u32 dest;
     char symbol;
 };
 
+/* Compressed sparse row layout: the edges of state u are at offsets[u]..offsets[u + 1] */
 struct Graph {
-    std::vector<std::vector<Transition>> adj;
+    std::vector<usize> offsets = {0};
+    std::vector<u32> dests;
+    std::vector<char> symbols;
     std::vector<u32> flags;
     usize start;
+    /* Only for a union of regexes: state u accepts patterns[pattern_offsets[u]..] */
+    std::vector<usize> pattern_offsets = {};
+    std::vector<u32> patterns = {};
+};
+
+struct SubsetSlot {
+    u64 hash;
+    usize id;
+};
+
+struct SubsetTable {
+    std::vector<u32> states;          /* Sorted subsets, stored back to back */
+    std::vector<usize> offsets = {0}; /* Subset i is states[offsets[i]..offsets[i + 1]] */
+    std::vector<SubsetSlot> slots;    /* Open addressing with Robin Hood probing */
+};
+
+/* Children still precede their parents in nodes, but some nodes may be unreachable */
+struct Simplifier {
+    std::pmr::vector<RegexNode> nodes;
+    std::vector<u32> canon;   /* Equal iff the subtrees of the nodes are equal */
+    SubsetTable ids;          /* Hash-conses the subtrees by (kind, symbol, left, right) */
+    std::vector<u32> factors; /* Factors of the alternatives of the union being simplified */
+};
+
+/* Literals of the strings matched by a node, kept to at most MAX_LITERAL bytes */
+struct LiteralInfo {
+    std::string prefix; /* Every string starts with it */
+    std::string suffix; /* Every string ends with it */
+    std::string factor; /* Every string contains it */
+    bool exact;         /* The node matches the prefix only, which is then the whole literal */
+};
+
+/* An alternative of a union, as the concatenation of factors[begin..end] */
+struct Sequence {
+    std::optional<u32> node; /* Node of the whole concatenation, if it is still in the tree */
+    usize begin;
+    usize end;
+};
+
+/* Symbols are equivalent iff they label the same edges. Class 0 holds the bytes on no edge. */
+struct SymbolClasses {
+    std::array<u8, NUM_CHARS> class_of;
+    usize num_classes;
+};
+
+struct PowersetScratch {
+    usize words;                   /* Size of a bitset */
+    SymbolClasses classes;
+    std::vector<char> symbols;     /* Symbols on the edges of the NFA, in increasing order */
+    std::vector<u64> bits;         /* One destination bitset for each symbol class */
+    std::vector<u8> touched;
+    std::vector<usize> class_dest; /* Destination subset identifier of each symbol class */
+    std::vector<u32> dest_subset;
+};
+
+struct SubsetShard {
+    std::mutex lock;
+    SubsetTable subsets;
+    std::vector<usize> ids; /* Global identifier of each subset of the shard */
+};
+
+struct WorkItem {
+    usize id;
+    usize shard;
+    usize local_id;
+};
+
+struct WorkDeque {
+    std::mutex lock;
+    std::deque<WorkItem> items;
+};
+
+struct ExpandedSubset {
+    usize id;
+    u32 flags;
+    std::vector<Transition> edges;
+    std::vector<u32> patterns;
+};
+
+struct Term {
+    TermKind kind;
+    bool nullable;
+    char symbol;
+    u32 left;
+    u32 right;
+};
+
+struct TermPool {
+    std::string_view alphabet;
+    SubsetTable ids;              /* Hash-conses the terms by (kind, symbol, left, right) */
+    std::vector<Term> terms;      /* Term 0 is ∅ and term 1 is ε */
+    std::vector<u32> derivatives; /* Derivative of term t through symbol i at t * |Σ| + i */
+};
+
+struct LazyDFA {
+    const Graph* nfa;
+    usize budget;                    /* Upper bound for the memory used by the cached states */
+    SymbolClasses classes;           /* Symbol classes of the NFA */
+    usize used = 0;
+    usize num_flushes = 0;
+    SubsetTable subsets = {};        /* NFA subsets of the cached DFA states */
+    std::vector<u32> next = {};      /* Cached edge of state s through class c at s * k + c */
+    std::vector<u32> flags = {};
+    std::vector<u64> bits = {};      /* Scratch buffers for computing a destination subset */
+    std::vector<u32> dest_subset = {};
+};
+
+/*
+ *  State identifiers are premultiplied by the number of classes, so that the
+ *  next state of s through byte c is table[s + classes[c]].
+ */
+struct DenseDFA {
+    SymbolClasses classes;
+    std::vector<u32> table;
+    std::vector<u8> accept; /* Indexed by the state number, not by its identifier */
+    u32 start;
+    u32 dead;
+    std::vector<usize> pattern_offsets; /* As in the graph of a union, plus the dead state */
+    std::vector<u32> patterns;
+};
+
+/* Tables of a dense DFA, owned by a DenseDFA or read from a mapped DFA file */
+struct DenseDFAView {
+    const u8* class_of;
+    const u32* table;
+    const u8* accept;
+    u32 num_classes;
+    u32 start;
+    u32 dead;
+};
+
+/*
+ *  Header of a DFA file, followed by the class of each byte, the table and
+ *  the accept flags of a DenseDFA at the given offsets from the beginning of
+ *  the file, then by the key of a cache entry. All fields are in the byte
+ *  order of the writer.
+ */
+struct DFAFileHeader {
+    u32 magic;
+    u32 version;
+    u32 num_states; /* Including the dead state */
+    u32 num_classes;
+    u32 start;
+    u32 dead;
+    u64 size;       /* Size of the whole file, a multiple of 8 */
+    u64 checksum;   /* Hash of the bytes after the header */
+    u64 class_offset;
+    u64 table_offset;
+    u64 accept_offset;
+    u64 key_offset; /* A u64 length then the bytes of the key, 0 outside of a cache */
+};
+
+struct MappedDFA {
+    void* data;
+    usize size;
+    DenseDFAView dfa;
+    std::string_view key;
+};
+
+/*
+ *  Dense DFA of a search, whose accepting states are numbered last so that
+ *  a single compare detects them. Identifiers are premultiplied as in a
+ *  DenseDFA.
+ */
+struct ScanDFA {
+    SymbolClasses classes;
+    std::vector<u32> table;
+    u32 start;
+    u32 dead;
+    u32 first_accept;
+};
+
+/*
+ *  A literal that every match contains, searched before running the DFA.
+ *  The reverse DFA reads backward from an occurrence the prefixes of the
+ *  matches, so it bounds where a match around the occurrence may start.
+ */
+struct Prefilter {
+    std::string literal;
+    ScanDFA reverse;
+};
+
+struct Scanner {
+    const ScanDFA* dfa;
+    const Prefilter* filter; /* Null when the regex has no required literal */
+    bool offsets;         /* Report the offsets of the match ends rather than the lines */
+    FILE* output;
+    const char* name;     /* Prefix of the reports, when several files are scanned */
+    usize num_threads;    /* Threads that scan the chunks of a mapped file */
+    usize num_matches = 0;
+    usize num_bytes = 0;
+    u8* buffer = nullptr; /* Page-aligned anonymous mapping, for the inputs that are read */
+    usize buffer_size = 0;
+};
+
+/* A part of a mapped file, scanned by a worker into its own output */
+struct ScanChunk {
+    const u8* begin;
+    const u8* end;
+    const u8* converged = nullptr; /* The reports past it do not depend on the entry state */
+    u32 exit = UNKNOWN_STATE;      /* State at the end of the chunk, once known */
+    std::string output = {};       /* Reports not written yet, up to SCAN_OUTPUT_BYTES */
+    usize num_matches = 0;
+    bool started = false;          /* The reports before converged are written */
+    bool done = false;
+};
+
+/* Chunks of a mapped file, whose outputs are written in order by the workers */
+struct ParallelScan {
+    const Scanner* scanner; /* As it was before the scan */
+    const u8* input;
+    std::vector<ScanChunk> chunks;
+    std::mutex lock;
+    std::condition_variable changed;
+    usize turn = 0; /* The chunks before it are written, and it may write its reports */
+};
+
+/* The output of a chunk, as the cookie of its stream */
+struct ChunkOutput {
+    ParallelScan* scan;
+    usize index;
+};
+
+/* Bytes lo..hi all lead to dest */
+struct SymbolRange {
+    u8 lo;
+    u8 hi;
+    u32 dest;
+};
+
+/* Machine code being assembled, whose rel32 jumps are patched once all labels are bound */
+struct JitCode {
+    std::vector<u8> bytes;
+    std::vector<usize> labels;                 /* Offset of each label */
+    std::vector<std::pair<usize, usize>> jumps; /* Offset of a rel32 and its target label */
+};
+
+struct JitDFA {
+    void* code;
+    usize size;
+    JitMatchFn entry; /* Returns whether the bytes in [begin, end) are matched */
+};
+
+/* Options of a compilation, shared by all the regexes of a batch */
+struct Context {
+    std::string alphabet = DEFAULT_ALPHABET;
+    Construction construction = Construction::THOMPSON;
+    OutputFormat format = OutputFormat::TEXT;
+    bool minimize = false;
+    bool lazy = false;
+    bool jit = false;
+    usize num_threads = 1;                 /* Threads of the powerset construction */
+    std::optional<std::string_view> input; /* Matched instead of printing the DFA */
+    const char* cache_dir = nullptr;
+};
+
+/* Output of a regex of a batch, buffered until the ones before it are written */
+struct BatchResult {
+    std::string output;
+    std::string errors;
+    int status = EXIT_SUCCESS;
+    bool done = false;
 };
 
 struct AgobjAttrs {
@@ -86,361 +404,2966 @@ struct AgobjAttrs {
     const char* rankdir = nullptr;
 };
 
-/* Globals */
-static std::string alphabet = DEFAULT_ALPHABET;
-static constexpr auto OP_PREC = []() {
-    std::array<u8, NUM_CHARS> arr = {};
-    arr[OP_KLEENE] = 3;
-    arr[OP_PLUS] = 3;
-    arr[OP_OPT] = 3;
-    arr[OP_CONCAT] = 2;
-    arr[OP_UNION] = 1;
-
-    return arr;
-}();
-
 /* Functions declarations */
-static TokenType type_of(char);
-static std::string add_concatenation_op(std::string_view);
-static std::optional<std::string> get_postfix(std::string_view);
-static std::optional<Graph> get_nfa_graph(std::string_view);
-static void add_transitive_closure_helper(usize, usize, std::vector<Transition>&, Graph&);
+static usize num_states(const Graph&);
+static auto edges(const Graph&, usize);
+static void add_edge(Graph&, usize, char);
+static void end_state(Graph&);
+static Graph make_graph(usize, std::span<const Edge>);
+static std::span<const u32> accepted_patterns(const Graph&, usize);
+static void add_accepted_patterns(const Graph&, std::span<const u32>, std::vector<u32>&);
+static Graph merge_nfa_graphs(std::span<const Graph>);
+static u32 add_simplified(Simplifier&, RegexNode);
+static void flatten(const Simplifier&, u32, NodeKind, std::vector<u32>&);
+static u32 make_chain(Simplifier&, NodeKind, std::span<const u32>);
+static u32 simplify_unary(Simplifier&, NodeKind, u32);
+static u32 make_sequence(Simplifier&, const Sequence&);
+static u32 simplify_union(Simplifier&, std::span<Sequence>, usize);
+static std::pmr::vector<RegexNode> simplify_regex(std::span<const RegexNode>,
+                                                  std::pmr::memory_resource*);
+static std::string get_required_literal(std::span<const RegexNode>);
+static Graph get_nfa_graph(std::span<const RegexNode>, std::pmr::memory_resource*);
+static Graph get_glushkov_graph(std::span<const RegexNode>, std::pmr::memory_resource*);
 static void add_transitive_closure(Graph&);
 static void remove_lambdas(Graph&);
+template<typename F>
+static u64 hash_words(std::span<const u32>, F&&);
+static u64 hash_subset(std::span<const u32>);
+static std::span<const u32> get_subset(const SubsetTable&, usize);
+static void insert_slot(SubsetTable&, SubsetSlot);
+static usize find_subset(const SubsetTable&, std::span<const u32>, u64);
+static usize add_subset(SubsetTable&, std::span<const u32>, u64);
+static std::pair<usize, bool> intern_subset(SubsetTable&, std::span<const u32>);
+static SymbolClasses get_symbol_classes(const Graph&);
+static PowersetScratch make_powerset_scratch(const Graph&);
+template<typename F>
+static void expand_subset(const Graph&, std::span<const u32>, PowersetScratch&, F&&);
 static Graph to_dfa_graph(const Graph&);
+static Graph to_dfa_graph_parallel(const Graph&, usize);
+static Graph minimize_dfa_graph(const Graph&);
+static u32 make_term(TermPool&, Term);
+static u32 make_concat(TermPool&, u32, u32);
+static u32 make_union(TermPool&, std::vector<u32>);
+static u32 make_star(TermPool&, u32);
+static u32 derive(TermPool&, u32, usize);
+static Graph get_derivative_dfa_graph(std::span<const RegexNode>, std::string_view);
+static u32 add_lazy_state(LazyDFA&);
+static u32 step_lazy_dfa(LazyDFA&, u32, usize);
+static bool match_lazy_dfa(LazyDFA&, std::string_view);
+static DenseDFA make_dense_dfa(const Graph&);
+static DenseDFAView view_dense_dfa(const DenseDFA&);
+static u32 run_dense_dfa(const DenseDFAView&, std::string_view);
+static bool match_dense_dfa(const DenseDFAView&, std::string_view);
+static bool write_dfa_file(const DenseDFA&, std::string_view, FILE*);
+static std::optional<MappedDFA> map_dfa_file(const char*, const char*&);
+static void unmap_dfa_file(MappedDFA&);
+static Graph get_dense_dfa_graph(const DenseDFAView&);
+static std::string get_cache_key(const Context&, std::string_view);
+static std::string get_cache_path(const Context&, std::string_view);
+static bool store_cached_dfa(const char*,
+                             const std::string&,
+                             std::string_view,
+                             const DenseDFA&);
+static Graph get_search_nfa_graph(const Graph&);
+static Graph get_reverse_prefix_graph(const Graph&);
+static ScanDFA make_scan_dfa(const Graph&);
+static const u8* find_literal(const u8*, const u8*, std::string_view);
+static bool scan_line(const ScanDFA&, const u8*, const u8*);
+static void report_offset(Scanner&, usize);
+static u32 scan_offsets(Scanner&, u32, const u8*, const u8*);
+static void scan_offsets_filtered(Scanner&, const u8*, const u8*);
+static void scan_lines(Scanner&, const u8*, const u8*);
+static void scan_block(Scanner&, const u8*, const u8*);
+static u32 converge_scan(const ScanDFA&, const u8*&, const u8*);
+static ssize_t write_chunk_output(void*, const char*, size_t);
+static void flush_chunk(ParallelScan&, usize);
+static void write_chunks(ParallelScan&, std::unique_lock<std::mutex>&);
+static void scan_chunk(ParallelScan&, usize);
+static void scan_parallel(Scanner&, const u8*, const u8*);
+static bool scan_mapped(Scanner&, int, usize);
+static bool grow_scan_buffer(Scanner&, usize);
+static bool scan_stream(Scanner&, int);
+static bool scan_file(Scanner&, int);
+static void free_scan_buffer(Scanner&);
+static void get_symbol_ranges(const Graph&, usize, std::vector<SymbolRange>&);
+static usize add_label(JitCode&);
+static void emit(JitCode&, std::initializer_list<u8>);
+static void emit_u32(JitCode&, u32);
+static void emit_jump(JitCode&, std::initializer_list<u8>, usize);
+static void emit_ranges(JitCode&, std::span<const SymbolRange>, usize);
+static std::optional<JitDFA> jit_compile_dfa(const Graph&);
+static bool match_jit_dfa(const JitDFA&, std::string_view);
+static void free_jit_dfa(JitDFA&);
 static void print_components(const Graph&, FILE*);
+static void print_symbol(u8, FILE*);
+static void print_ranges(std::span<const SymbolRange>, usize, FILE*);
+static void print_c_source(const Graph&, FILE*, std::string_view, const char*);
 static void set_attrs(void*, const AgobjAttrs&);
 static void export_graph(const Graph&, FILE*, std::string_view);
+static std::optional<Graph> compile_regex(const Context&,
+                                          std::string_view,
+                                          FILE*,
+                                          std::string*);
+static int write_dfa(const Context&,
+                     const Graph&,
+                     std::string_view,
+                     const char*,
+                     FILE*,
+                     FILE*);
+static int run_regex(const Context&, std::string_view, const char*, FILE*, FILE*);
+static int run_union(const Context&, std::span<const std::string>, FILE*, FILE*);
+static int run_scan(const Context&, std::string_view, std::span<char* const>, bool, FILE*);
+static std::vector<std::string> read_regexes(FILE*);
+static int run_batch(const Context&, std::span<const std::string>, FILE*);
 static void usage();
 
 /* Functions definitions  */
-template<>
-struct std::hash<std::vector<usize>> {
-    std::size_t
-    operator()(const std::vector<usize>& xs) const noexcept
+usize
+num_states(const Graph& g)
+{
+    return g.offsets.size() - 1;
+}
+
+auto
+edges(const Graph& g, const usize u)
+{
+    auto transition = [&g](usize e) { return Transition{g.dests[e], g.symbols[e]}; };
+    return std::views::iota(g.offsets[u], g.offsets[u + 1]) |
+           std::views::transform(transition);
+}
+
+void
+add_edge(Graph& g, const usize dest, const char symbol)
+{
+    /* Add an edge to the last state, whose edges have not been ended yet */
+    g.dests.push_back(u32(dest));
+    g.symbols.push_back(symbol);
+}
+
+void
+end_state(Graph& g)
+{
+    g.offsets.push_back(g.dests.size());
+}
+
+Graph
+make_graph(const usize size, const std::span<const Edge> edge_list)
+{
+    Graph g{};
+
+    /* Group the edges by source state with a counting sort */
+    g.offsets.assign(size + 1, 0);
+    for (auto& e : edge_list)
+        ++g.offsets[e.src + 1];
+    std::partial_sum(g.offsets.begin(), g.offsets.end(), g.offsets.begin());
+
+    std::vector<Transition> ts(edge_list.size());
     {
-        std::size_t seed = 0;
-        for (std::size_t x : xs)
-            seed ^= x + 0x9e3779b9 + (seed << 6) + (seed >> 2); /* from boost::hash_combine */
+        auto fill = g.offsets;
+        for (auto [src, dest, symbol] : edge_list)
+            ts[fill[src]++] = {dest, symbol};
+    }
+
+    /* Sort the edges of every state, dropping the duplicates */
+    g.dests.reserve(ts.size());
+    g.symbols.reserve(ts.size());
+    for (usize u = 0; u < size; ++u) {
+        auto first = ts.begin() + ptrdiff_t(g.offsets[u]);
+        auto last = ts.begin() + ptrdiff_t(g.offsets[u + 1]);
+        std::sort(first, last);
+        last = std::unique(first, last);
 
-        return seed;
+        g.offsets[u] = g.dests.size();
+        for (auto it = first; it != last; ++it) {
+            g.dests.push_back(it->dest);
+            g.symbols.push_back(it->symbol);
+        }
     }
-};
+    g.offsets[size] = g.dests.size();
+    g.flags.resize(size);
+
+    return g;
+}
+
+std::span<const u32>
+accepted_patterns(const Graph& g, const usize u)
+{
+    const auto first = g.patterns.begin() + ptrdiff_t(g.pattern_offsets[u]);
+    const auto last = g.patterns.begin() + ptrdiff_t(g.pattern_offsets[u + 1]);
+    return {first, last};
+}
 
-TokenType
-type_of(char token)
+void
+add_accepted_patterns(const Graph& nfa,
+                      const std::span<const u32> subset,
+                      std::vector<u32>& patterns)
 {
-    auto token_idx = u8(token);
+    /* Append the patterns accepted by the states of the subset, sorted and deduplicated */
+    const auto begin = ptrdiff_t(patterns.size());
+    for (auto u : subset) {
+        for (auto pattern : accepted_patterns(nfa, u))
+            patterns.push_back(pattern);
+    }
 
-    if (OP_PREC[token_idx])
-        return TokenType::OPERATOR;
-    if (token == '(')
-        return TokenType::LEFT_PAREN;
-    if (token == ')')
-        return TokenType::RIGHT_PAREN;
-    if (alphabet.find(token) != alphabet.npos)
-        return TokenType::REGULAR;
-    return TokenType::ERROR;
+    std::sort(patterns.begin() + begin, patterns.end());
+    patterns.erase(std::unique(patterns.begin() + begin, patterns.end()), patterns.end());
 }
 
-std::string
-add_concatenation_op(const std::string_view infix)
+Graph
+merge_nfa_graphs(const std::span<const Graph> nfas)
+{
+    /*
+     *  The new start state 0 has the edges of the start states of all the
+     *  λ-free NFAs, and accepts the patterns whose start state is final. The
+     *  states of NFA i follow, each final state accepting pattern i.
+     */
+    Graph g{};
+    g.flags.push_back(START);
+    g.start = 0;
+    g.pattern_offsets = {0};
+
+    usize base = 1;
+    for (usize i = 0; i < nfas.size(); ++i) {
+        const auto& nfa = nfas[i];
+        for (auto [dest, symbol] : edges(nfa, nfa.start))
+            add_edge(g, base + dest, symbol);
+        if (nfa.flags[nfa.start] & FINAL) {
+            g.flags[0] |= FINAL;
+            g.patterns.push_back(u32(i));
+        }
+        base += num_states(nfa);
+    }
+    end_state(g);
+    g.pattern_offsets.push_back(g.patterns.size());
+
+    base = 1;
+    for (usize i = 0; i < nfas.size(); ++i) {
+        const auto& nfa = nfas[i];
+        for (usize u = 0; u < num_states(nfa); ++u) {
+            for (auto [dest, symbol] : edges(nfa, u))
+                add_edge(g, base + dest, symbol);
+            end_state(g);
+
+            g.flags.push_back(nfa.flags[u] & FINAL);
+            if (nfa.flags[u] & FINAL)
+                g.patterns.push_back(u32(i));
+            g.pattern_offsets.push_back(g.patterns.size());
+        }
+        base += num_states(nfa);
+    }
+
+    return g;
+}
+
+u32
+add_simplified(Simplifier& s, const RegexNode node)
 {
-    if (infix.empty())
-        return "";
+    const bool binary = node.kind == NodeKind::CONCAT || node.kind == NodeKind::UNION;
+    const std::array<u32, 3> key = {
+        u32(node.kind) | u32(u8(node.symbol)) << 8,
+        node.kind == NodeKind::SYMBOL ? 0 : s.canon[node.left],
+        binary ? s.canon[node.right] : 0,
+    };
+    s.canon.push_back(u32(intern_subset(s.ids, key).first));
+    s.nodes.push_back(node);
 
-    std::string result{infix.substr(0, 1)};
-    for (usize i = 1; i < infix.size(); ++i) {
-        const char a = infix[i - 1];
-        const char b = infix[i];
-        const auto t_a = type_of(a);
-        const auto t_b = type_of(b);
+    return u32(s.nodes.size() - 1);
+}
 
-        /* Cases where the concatenation operator needs to be added */
-        if ((t_a == TokenType::REGULAR || IS_UNARY(a) || a == ')') &&
-            (t_b == TokenType::REGULAR || b == '('))
-            result += OP_CONCAT;
+void
+flatten(const Simplifier& s, const u32 node, const NodeKind kind, std::vector<u32>& out)
+{
+    /* Collect the operands of a chain of 'kind' nodes, from left to right */
+    std::vector<u32> pending = {node};
+    while (!pending.empty()) {
+        const u32 u = pending.back();
+        pending.pop_back();
 
-        result += b;
+        if (s.nodes[u].kind == kind) {
+            pending.push_back(s.nodes[u].right);
+            pending.push_back(s.nodes[u].left);
+        } else {
+            out.push_back(u);
+        }
     }
+}
+
+u32
+make_chain(Simplifier& s, const NodeKind kind, const std::span<const u32> operands)
+{
+    u32 result = operands[0];
+    for (auto u : operands.subspan(1))
+        result = add_simplified(s, {kind, S_LAMBDA, result, u});
 
     return result;
 }
 
-std::optional<std::string>
-get_postfix(const std::string_view infix)
+u32
+simplify_unary(Simplifier& s, const NodeKind kind, const u32 child)
 {
-    /* Apply Dijkstra's 'shunting yard' algorithm */
+    /*
+     *  Nested unary operators collapse into one: the same operator twice is
+     *  itself (a** = a*, (a?)? = a?), and any other pair is a Kleene star
+     *  ((a*)+ = (a*)? = (a+)? = a*).
+     */
+    const auto inner = s.nodes[child].kind;
+    if (inner != NodeKind::STAR && inner != NodeKind::PLUS && inner != NodeKind::OPT)
+        return add_simplified(s, {kind, S_LAMBDA, child, 0});
+    if (inner == kind || inner == NodeKind::STAR)
+        return child;
 
-    std::string postfix = "";
-    std::stack<char, std::vector<char>> operators;
-    for (char token : infix) {
-        switch (type_of(token)) {
-        case TokenType::REGULAR:
-            postfix += token;
-            break;
-        case TokenType::OPERATOR:
-            while (!operators.empty() && operators.top() != '(' &&
-                   OP_PREC[u8(operators.top())] >= OP_PREC[u8(token)]) {
-                postfix += operators.top();
-                operators.pop();
-            }
+    return add_simplified(s, {NodeKind::STAR, S_LAMBDA, s.nodes[child].left, 0});
+}
 
-            operators.push(token);
-            break;
-        case TokenType::LEFT_PAREN:
-            operators.push(token);
-            break;
-        case TokenType::RIGHT_PAREN:
-            while (!operators.empty() && operators.top() != '(') {
-                postfix += operators.top();
-                operators.pop();
+u32
+make_sequence(Simplifier& s, const Sequence& seq)
+{
+    if (seq.node)
+        return *seq.node;
+
+    const auto factors = std::span(s.factors).subspan(seq.begin, seq.end - seq.begin);
+    return make_chain(s, NodeKind::CONCAT, factors);
+}
+
+u32
+simplify_union(Simplifier& s, const std::span<Sequence> seqs, const usize depth)
+{
+    /*
+     *  The alternatives are sorted and distinct, so the ones that start alike
+     *  are adjacent and share the longest common prefix of the first and the
+     *  last of them, which is factored out: ab|ac = a(b|c) and a|ab = a(b)?.
+     */
+    auto head_of = [&s](const Sequence& seq) { return s.canon[s.factors[seq.begin]]; };
+    std::vector<u32> results;
+    for (usize begin = 0, end; begin < seqs.size(); begin = end) {
+        for (end = begin + 1; end < seqs.size() && head_of(seqs[end]) == head_of(seqs[begin]);
+             ++end)
+            ;
+
+        if (end - begin == 1) {
+            results.push_back(make_sequence(s, seqs[begin]));
+            continue;
+        }
+
+        const auto& first = seqs[begin];
+        const auto& last = seqs[end - 1];
+        usize prefix = 1;
+        while (first.begin + prefix < first.end && last.begin + prefix < last.end &&
+               s.canon[s.factors[first.begin + prefix]] ==
+                   s.canon[s.factors[last.begin + prefix]])
+            ++prefix;
+
+        const auto common = std::span(s.factors).subspan(first.begin, prefix);
+        const u32 factored = make_chain(s, NodeKind::CONCAT, common);
+        for (usize i = begin; i < end; ++i) {
+            seqs[i].begin += prefix;
+            seqs[i].node = std::nullopt;
+        }
+
+        /* Only the first alternative can be the whole prefix, which makes the rest optional */
+        const bool optional = seqs[begin].begin == seqs[begin].end;
+        const auto tails = seqs.subspan(begin + optional, end - begin - optional);
+
+        u32 rest;
+        if (tails.size() == 1) {
+            rest = make_sequence(s, tails[0]);
+        } else if (depth < MAX_NESTING) {
+            rest = simplify_union(s, tails, depth + 1);
+        } else {
+            std::vector<u32> alternatives;
+            for (auto& seq : tails)
+                alternatives.push_back(make_sequence(s, seq));
+            rest = make_chain(s, NodeKind::UNION, alternatives);
+        }
+
+        if (optional)
+            rest = simplify_unary(s, NodeKind::OPT, rest);
+        results.push_back(add_simplified(s, {NodeKind::CONCAT, S_LAMBDA, factored, rest}));
+    }
+
+    return make_chain(s, NodeKind::UNION, results);
+}
+
+std::pmr::vector<RegexNode>
+simplify_regex(const std::span<const RegexNode> ast, std::pmr::memory_resource* arena)
+{
+    /* Rewrite the AST into a smaller one for the same language */
+
+    Simplifier s{
+        .nodes = std::pmr::vector<RegexNode>(arena), .canon = {}, .ids = {}, .factors = {}};
+    s.nodes.reserve(ast.size());
+    s.canon.reserve(ast.size());
+
+    /* Unions are simplified as a whole at the top of each chain of unions */
+    std::vector<u8> in_union(ast.size());
+    for (auto& node : ast) {
+        if (node.kind == NodeKind::UNION)
+            in_union[node.left] = in_union[node.right] = 1;
+    }
+
+    /* The simplified node of node i is map[i] */
+    std::vector<u32> map(ast.size());
+    std::vector<u32> alternatives;
+    std::vector<Sequence> seqs;
+    auto factors_of = [&s](const Sequence& seq) {
+        return std::span(s.factors).subspan(seq.begin, seq.end - seq.begin);
+    };
+    auto canon_of = [&s](u32 u) { return s.canon[u]; };
+    for (usize i = 0; i < ast.size(); ++i) {
+        auto [kind, symbol, left, right] = ast[i];
+
+        if (kind == NodeKind::SYMBOL) {
+            map[i] = add_simplified(s, ast[i]);
+        } else if (kind == NodeKind::CONCAT) {
+            map[i] = add_simplified(s, {kind, symbol, map[left], map[right]});
+        } else if (kind == NodeKind::UNION) {
+            map[i] = add_simplified(s, {kind, symbol, map[left], map[right]});
+            if (in_union[i])
+                continue;
+
+            alternatives.clear();
+            flatten(s, map[i], NodeKind::UNION, alternatives);
+            s.factors.clear();
+            seqs.clear();
+            for (auto u : alternatives) {
+                const usize begin = s.factors.size();
+                flatten(s, u, NodeKind::CONCAT, s.factors);
+                seqs.push_back({u, begin, s.factors.size()});
             }
 
-            if (operators.empty() || operators.top() != '(')
-                return std::nullopt;
+            /* Sort the alternatives by their factors, dropping the duplicates (a|a = a) */
+            ranges::stable_sort(seqs, [&](const Sequence& x, const Sequence& y) {
+                return ranges::lexicographical_compare(
+                    factors_of(x), factors_of(y), {}, canon_of, canon_of);
+            });
+            auto duplicates = ranges::unique(seqs, [&](const Sequence& x, const Sequence& y) {
+                return ranges::equal(factors_of(x), factors_of(y), {}, canon_of, canon_of);
+            });
+            seqs.erase(duplicates.begin(), duplicates.end());
 
-            operators.pop();
-            break;
-        case TokenType::ERROR:
-            return std::nullopt;
+            /* Keep the union unless it has duplicates or alternatives that start alike */
+            const bool factorable = ranges::adjacent_find(seqs, {}, [&](const Sequence& seq) {
+                return s.canon[s.factors[seq.begin]];
+            }) != seqs.end();
+            if (factorable || seqs.size() < alternatives.size())
+                map[i] = simplify_union(s, seqs, 0);
+        } else {
+            map[i] = simplify_unary(s, kind, map[left]);
         }
     }
 
-    while (!operators.empty()) {
-        auto op = operators.top();
-        if (op == '(')
-            return std::nullopt;
+    /* Drop the nodes that were rewritten away, keeping the children before their parents */
+    std::vector<u8> reachable(s.nodes.size());
+    reachable[map.back()] = 1;
+    for (usize u = map.back() + 1; u-- > 0;) {
+        if (!reachable[u])
+            continue;
+
+        auto [kind, symbol, left, right] = s.nodes[u];
+        if (kind != NodeKind::SYMBOL)
+            reachable[left] = 1;
+        if (kind == NodeKind::CONCAT || kind == NodeKind::UNION)
+            reachable[right] = 1;
+    }
+
+    std::pmr::vector<RegexNode> result(arena);
+    std::vector<u32> ids(s.nodes.size());
+    for (usize u = 0; u <= map.back(); ++u) {
+        if (!reachable[u])
+            continue;
 
-        postfix += op;
-        operators.pop();
+        auto node = s.nodes[u];
+        if (node.kind != NodeKind::SYMBOL)
+            node.left = ids[node.left];
+        if (node.kind == NodeKind::CONCAT || node.kind == NodeKind::UNION)
+            node.right = ids[node.right];
+        ids[u] = u32(result.size());
+        result.push_back(node);
     }
 
-    return postfix;
+    return result;
 }
 
-std::optional<Graph>
-get_nfa_graph(const std::string_view postfix)
+std::string
+get_required_literal(const std::span<const RegexNode> ast)
 {
-    /* Apply Thompson's construction algorithm */
+    /*
+     *  Find a literal that every string matched by the regex contains, from
+     *  the prefixes, suffixes and factors of the nodes. A concatenation joins
+     *  the suffix of its left operand to the prefix of the right one, and a
+     *  union only keeps what its alternatives have in common. Truncating a
+     *  literal keeps it required, but no longer exact.
+     */
+    const auto longest = [](std::initializer_list<const std::string*> literals) {
+        return *ranges::max(literals, {}, [](auto* literal) { return literal->size(); });
+    };
+    const auto truncate = [](LiteralInfo& info) {
+        if (info.prefix.size() > MAX_LITERAL || info.suffix.size() > MAX_LITERAL)
+            info.exact = false;
+        if (info.prefix.size() > MAX_LITERAL)
+            info.prefix.resize(MAX_LITERAL);
+        if (info.suffix.size() > MAX_LITERAL)
+            info.suffix.erase(0, info.suffix.size() - MAX_LITERAL);
+        if (info.factor.size() > MAX_LITERAL)
+            info.factor.resize(MAX_LITERAL);
+    };
 
-    Graph g{};
-    auto& [adj, flags, _] = g;
+    std::vector<LiteralInfo> infos;
+    infos.reserve(ast.size());
+    for (auto [kind, symbol, left, right] : ast) {
+        LiteralInfo info{};
 
-    std::stack<NFAFragment, std::vector<NFAFragment>> nfa_components;
-    for (char token : postfix) {
-        usize q, f;
+        if (kind == NodeKind::SYMBOL) {
+            info = {{symbol}, {symbol}, {symbol}, true};
+        } else if (kind == NodeKind::CONCAT) {
+            const auto& x = infos[left];
+            const auto& y = infos[right];
+            const std::string joined = x.suffix + y.prefix;
+            info.exact = x.exact && y.exact;
+            info.prefix = x.exact ? x.prefix + y.prefix : x.prefix;
+            info.suffix = y.exact ? x.suffix + y.suffix : y.suffix;
+            info.factor = longest({&x.factor, &y.factor, &joined});
+        } else if (kind == NodeKind::UNION) {
+            const auto& x = infos[left];
+            const auto& y = infos[right];
+            const auto prefix = ranges::mismatch(x.prefix, y.prefix).in1;
+            const auto suffix = ranges::mismatch(x.suffix | std::views::reverse,
+                                                 y.suffix | std::views::reverse).in1;
+            info.exact = x.exact && y.exact && x.prefix == y.prefix;
+            info.prefix.assign(x.prefix.begin(), prefix);
+            info.suffix.assign(suffix.base(), x.suffix.end());
+            info.factor =
+                x.factor == y.factor ? x.factor : longest({&info.prefix, &info.suffix});
+        } else if (kind == NodeKind::PLUS) {
+            /* The repetitions start and end like the operand */
+            info = infos[left];
+            info.exact = false;
+        }
+        /* A star or an option also matches the empty string, which has no literal */
 
-        if (token == OP_CONCAT || token == OP_UNION) {
-            if (nfa_components.size() < 2)
-                return std::nullopt;
+        truncate(info);
+        infos.push_back(std::move(info));
+    }
 
-            auto y = nfa_components.top();
-            nfa_components.pop();
-            auto x = nfa_components.top();
-            nfa_components.pop();
+    return infos.empty() ? std::string() : infos.back().factor;
+}
 
-            if (token == OP_CONCAT) {
-                adj[x.finish] = {{y.start, S_LAMBDA}};
+Graph
+get_nfa_graph(const std::span<const RegexNode> ast, std::pmr::memory_resource* arena)
+{
+    /* Apply Thompson's construction algorithm, with its scratch in the arena */
+    const auto nfa = rtd::get_thompson_nfa(
+        ast, std::pmr::vector<Edge>(arena), std::pmr::vector<NFAFragment>(arena));
+    auto [start, finish] = nfa.root;
 
-                q = x.start;
-                f = y.finish;
-            } else {
-                q = adj.size();
-                adj.emplace_back();
-                adj[q] = {{x.start, S_LAMBDA}, {y.start, S_LAMBDA}};
-
-                f = adj.size();
-                adj.emplace_back();
-
-                adj[x.finish] = {{f, S_LAMBDA}};
-                adj[y.finish] = {{f, S_LAMBDA}};
-            }
-        } else if (IS_UNARY(token)) {
-            if (nfa_components.empty())
-                return std::nullopt;
-
-            auto x = nfa_components.top();
-            nfa_components.pop();
-
-            f = adj.size();
-            adj.emplace_back();
-            q = adj.size();
-            adj.emplace_back();
-
-            if (token == OP_KLEENE) {
-                adj[q] = {{x.start, S_LAMBDA}, {f, S_LAMBDA}};
-                adj[x.finish] = {{x.start, S_LAMBDA}, {f, S_LAMBDA}};
-            } else if (token == OP_PLUS) {
-                adj[q] = {{x.start, S_LAMBDA}};
-                adj[x.finish] = {{x.start, S_LAMBDA}, {f, S_LAMBDA}};
+    Graph g = make_graph(nfa.size, nfa.edges);
+    g.start = start;
+    g.flags[start] |= START;
+    g.flags[finish] |= FINAL;
+
+    return g;
+}
+
+Graph
+get_glushkov_graph(const std::span<const RegexNode> ast, std::pmr::memory_resource* arena)
+{
+    /*
+     *  Apply Glushkov's construction algorithm: every symbol occurrence in the
+     *  regex (a position) becomes a state, and there is an edge from position
+     *  p to position q iff q is in followpos(p). State 0 is the start state.
+     */
+
+    std::pmr::vector<Edge> edge_list(arena);
+    std::pmr::vector<char> symbols({S_LAMBDA}, arena);
+    /* The fragment of node i is fragments[i], whose position sets are moved to its parent */
+    std::pmr::vector<GlushkovFragment> fragments(arena);
+    fragments.reserve(ast.size());
+    auto add_follow = [&](std::span<const usize> from, std::span<const usize> to) {
+        for (auto p : from) {
+            for (auto q : to)
+                edge_list.push_back({u32(p), u32(q), symbols[q]});
+        }
+    };
+
+    for (auto [kind, symbol, left, right] : ast) {
+        if (kind == NodeKind::CONCAT || kind == NodeKind::UNION) {
+            auto& x = fragments[left];
+            auto& y = fragments[right];
+
+            if (kind == NodeKind::CONCAT) {
+                add_follow(x.last, y.first);
+
+                if (x.nullable)
+                    x.first.insert(x.first.end(), y.first.begin(), y.first.end());
+                if (y.nullable)
+                    x.last.insert(x.last.end(), y.last.begin(), y.last.end());
+                else
+                    x.last = std::move(y.last);
+                x.nullable = x.nullable && y.nullable;
             } else {
-                adj[q] = {{x.start, S_LAMBDA}, {f, S_LAMBDA}};
-                adj[x.finish] = {{f, S_LAMBDA}};
+                x.first.insert(x.first.end(), y.first.begin(), y.first.end());
+                x.last.insert(x.last.end(), y.last.begin(), y.last.end());
+                x.nullable = x.nullable || y.nullable;
             }
+
+            fragments.push_back(std::move(x));
+        } else if (kind != NodeKind::SYMBOL) {
+            auto& x = fragments[left];
+            if (kind != NodeKind::OPT)
+                add_follow(x.last, x.first);
+            if (kind != NodeKind::PLUS)
+                x.nullable = true;
+
+            fragments.push_back(std::move(x));
         } else {
-            f = adj.size();
-            adj.emplace_back();
+            const usize pos = symbols.size();
+            symbols.push_back(symbol);
+            fragments.push_back({false, {{pos}, arena}, {{pos}, arena}});
+        }
+    }
+
+    auto& root = fragments.back();
+    const usize start = 0;
+    add_follow({&start, 1}, root.first);
+
+    Graph g = make_graph(symbols.size(), edge_list);
+    g.flags[0] |= START;
+    if (root.nullable)
+        g.flags[0] |= FINAL;
+    for (auto p : root.last)
+        g.flags[p] |= FINAL;
+    g.start = 0;
+
+    return g;
+}
+
+void
+add_transitive_closure(Graph& g)
+{
+    /*
+     *  Collapse the λ-cycles into strongly connected components using an
+     *  iterative version of Tarjan's algorithm, then compute the λ-closure of
+     *  each component as the union of its own states and of the closures of
+     *  its successors. Tarjan's algorithm completes the components in reverse
+     *  topological order, so the successors are always processed first.
+     */
+
+    const usize size = num_states(g);
+    const usize npos = usize(-1);
+
+    struct Frame {
+        usize u;
+        usize edge;
+    };
+
+    std::vector<usize> index(size, npos);
+    std::vector<usize> low(size);
+    std::vector<usize> comp(size, npos);
+    std::vector<usize> stack;
+    std::vector<Frame> frames;
+    usize next_index = 0;
+    usize num_comps = 0;
+
+    for (usize root = 0; root < size; ++root) {
+        if (index[root] != npos)
+            continue;
+
+        index[root] = low[root] = next_index++;
+        stack.push_back(root);
+        frames.push_back({root, g.offsets[root]});
+
+        while (!frames.empty()) {
+            auto& frame = frames.back();
+            const usize u = frame.u;
+
+            if (frame.edge < g.offsets[u + 1]) {
+                const usize v = g.dests[frame.edge];
+                const char symbol = g.symbols[frame.edge++];
+                if (symbol != S_LAMBDA)
+                    continue;
 
-            q = adj.size();
-            adj.emplace_back();
-            adj[q] = {{f, token}};
+                if (index[v] == npos) {
+                    index[v] = low[v] = next_index++;
+                    stack.push_back(v);
+                    frames.push_back({v, g.offsets[v]});
+                } else if (comp[v] == npos) {
+                    low[u] = std::min(low[u], index[v]);
+                }
+                continue;
+            }
+
+            /* All the edges of u have been explored, so u may be the root of a component */
+            if (low[u] == index[u]) {
+                usize v;
+                do {
+                    v = stack.back();
+                    stack.pop_back();
+                    comp[v] = num_comps;
+                } while (v != u);
+                ++num_comps;
+            }
+
+            frames.pop_back();
+            if (!frames.empty())
+                low[frames.back().u] = std::min(low[frames.back().u], low[u]);
         }
+    }
 
-        nfa_components.push({q, f});
+    /* Group the states by component */
+    std::vector<usize> comp_offsets(num_comps + 1, 0);
+    std::vector<usize> comp_states(size);
+    for (usize u = 0; u < size; ++u)
+        ++comp_offsets[comp[u] + 1];
+    std::partial_sum(comp_offsets.begin(), comp_offsets.end(), comp_offsets.begin());
+    {
+        auto fill = comp_offsets;
+        for (usize u = 0; u < size; ++u)
+            comp_states[fill[comp[u]]++] = u;
     }
 
-    if (nfa_components.empty())
-        return std::nullopt;
+    /* Compute the closures of the components, in reverse topological order */
+    std::vector<usize> closure_offsets = {0};
+    std::vector<usize> closure_states;
+    std::vector<usize> added_by(size, npos);
+    std::vector<u32> closure_final(num_comps, 0);
 
-    auto [start, finish] = nfa_components.top();
+    for (usize c = 0; c < num_comps; ++c) {
+        auto add = [&](usize w) {
+            if (added_by[w] != c) {
+                added_by[w] = c;
+                closure_states.push_back(w);
+                closure_final[c] |= g.flags[w] & FINAL;
+            }
+        };
 
-    g.start = start;
+        for (usize i = comp_offsets[c]; i < comp_offsets[c + 1]; ++i)
+            add(comp_states[i]);
 
-    flags.resize(adj.size());
-    flags[start] |= START;
-    flags[finish] |= FINAL;
+        for (usize i = comp_offsets[c]; i < comp_offsets[c + 1]; ++i) {
+            for (auto [v, symbol] : edges(g, comp_states[i])) {
+                const usize d = comp[v];
+                if (symbol != S_LAMBDA || d == c)
+                    continue;
 
-    return g;
+                for (usize j = closure_offsets[d]; j < closure_offsets[d + 1]; ++j)
+                    add(closure_states[j]);
+            }
+        }
+
+        closure_offsets.push_back(closure_states.size());
+    }
+
+    /*
+     *  Connect every state to its closure through λ-transitions, which replace
+     *  the original ones. The symbol edges of each state are kept in front.
+     */
+    Graph closed{};
+    closed.flags = std::move(g.flags);
+    closed.start = g.start;
+    for (usize u = 0; u < size; ++u) {
+        const usize c = comp[u];
+        closed.flags[u] |= closure_final[c];
+
+        for (auto [v, symbol] : edges(g, u)) {
+            if (symbol != S_LAMBDA)
+                add_edge(closed, v, symbol);
+        }
+        for (usize j = closure_offsets[c]; j < closure_offsets[c + 1]; ++j) {
+            if (closure_states[j] != u)
+                add_edge(closed, closure_states[j], S_LAMBDA);
+        }
+        end_state(closed);
+    }
+
+    g = std::move(closed);
 }
 
 void
-add_transitive_closure_helper(usize from, usize src, std::vector<Transition>& to_add, Graph& g)
+remove_lambdas(Graph& g)
 {
-    auto& [adj, flags, _] = g;
+    /*
+     *  The λ-transitions already reach the whole closure, so each state only
+     *  needs its own symbol edges and those of its λ-successors. These come
+     *  before the λ-transitions in every edge list.
+     */
+    Graph result{};
+    result.flags = std::move(g.flags);
+    result.start = g.start;
 
-    if (flags[src] & VISITED)
-        return;
+    std::vector<Transition> ts;
+    for (usize u = 0; u < num_states(g); ++u) {
+        ts.clear();
+        for (auto [v, to_v] : edges(g, u)) {
+            if (to_v != S_LAMBDA) {
+                ts.emplace_back(v, to_v);
+                continue;
+            }
+
+            for (auto [w, to_w] : edges(g, v)) {
+                if (to_w == S_LAMBDA)
+                    break;
+                ts.emplace_back(w, to_w);
+            }
+        }
+
+        ranges::sort(ts);
+        auto duplicates = ranges::unique(ts);
+        ts.erase(duplicates.begin(), duplicates.end());
+
+        for (auto [dest, symbol] : ts)
+            add_edge(result, dest, symbol);
+        end_state(result);
+    }
+
+    g = std::move(result);
+}
+
+u64
+hash_subset(const std::span<const u32> subset)
+{
+    return hash_words(subset, [](usize, u32) {});
+}
 
-    flags[src] |= VISITED;
+template<typename F>
+u64
+hash_words(const std::span<const u32> words, F&& visit)
+{
+    /*
+     *  Mix four independent lanes, so that the loop can be vectorized. Each
+     *  word is also passed to visit with its index, for the callers that check
+     *  the words while hashing them.
+     */
+    std::array<u64, 4> lanes = {
+        0x9e3779b97f4a7c15, 0xc2b2ae3d27d4eb4f, 0x165667b19e3779f9, 0x27d4eb2f165667c5};
+
+    usize i = 0;
+    for (; i + lanes.size() <= words.size(); i += lanes.size()) {
+        for (usize j = 0; j < lanes.size(); ++j) {
+            visit(i + j, words[i + j]);
+            lanes[j] = (lanes[j] ^ words[i + j]) * 0xff51afd7ed558ccd;
+        }
+    }
+    for (; i < words.size(); ++i) {
+        visit(i, words[i]);
+        lanes[0] = (lanes[0] ^ words[i]) * 0xff51afd7ed558ccd;
+    }
+
+    /* Finalize with the avalanche step of MurmurHash3 */
+    u64 h = lanes[0] ^ std::rotl(lanes[1], 16) ^ std::rotl(lanes[2], 32) ^
+            std::rotl(lanes[3], 48);
+    h ^= words.size();
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccd;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53;
+    h ^= h >> 33;
+
+    return h;
+}
 
-    for (auto [dest, symbol] : adj[src]) {
-        if (symbol == S_LAMBDA) {
-            to_add.emplace_back(dest, symbol);
-            flags[from] |= flags[dest] & FINAL;
+std::span<const u32>
+get_subset(const SubsetTable& table, const usize id)
+{
+    const auto first = table.states.begin() + ptrdiff_t(table.offsets[id]);
+    const auto last = table.states.begin() + ptrdiff_t(table.offsets[id + 1]);
+    return {first, last};
+}
+
+void
+insert_slot(SubsetTable& table, SubsetSlot slot)
+{
+    const usize mask = table.slots.size() - 1;
+
+    /* Steal the place of any entry that is closer to its home slot than the inserted one */
+    usize idx = slot.hash & mask;
+    for (usize dist = 0;; idx = (idx + 1) & mask, ++dist) {
+        auto& cur = table.slots[idx];
+        if (cur.id == EMPTY_SLOT) {
+            cur = slot;
+            return;
+        }
 
-            add_transitive_closure_helper(from, dest, to_add, g);
+        const usize cur_dist = (idx - (cur.hash & mask)) & mask;
+        if (cur_dist < dist) {
+            std::swap(cur, slot);
+            dist = cur_dist;
         }
     }
 }
 
+usize
+find_subset(const SubsetTable& table, const std::span<const u32> subset, const u64 hash)
+{
+    /* Returns the identifier of the subset, or EMPTY_SLOT if it is not in the table */
+    if (table.slots.empty())
+        return EMPTY_SLOT;
+
+    const usize mask = table.slots.size() - 1;
+    usize idx = hash & mask;
+    for (usize dist = 0;; idx = (idx + 1) & mask, ++dist) {
+        const auto& cur = table.slots[idx];
+        if (cur.id == EMPTY_SLOT || ((idx - (cur.hash & mask)) & mask) < dist)
+            return EMPTY_SLOT;
+        if (cur.hash == hash && ranges::equal(get_subset(table, cur.id), subset))
+            return cur.id;
+    }
+}
+
+usize
+add_subset(SubsetTable& table, const std::span<const u32> subset, const u64 hash)
+{
+    /* Add a subset that is not in the table yet, whose hash is already known */
+    const usize num_subsets = table.offsets.size() - 1;
+
+    /* Keep the load factor at most 3/4 */
+    if (4 * (num_subsets + 1) > 3 * table.slots.size()) {
+        const usize num_slots = std::max<usize>(16, 2 * table.slots.size());
+        auto old_slots =
+            std::exchange(table.slots, std::vector<SubsetSlot>(num_slots, {0, EMPTY_SLOT}));
+        for (auto slot : old_slots) {
+            if (slot.id != EMPTY_SLOT)
+                insert_slot(table, slot);
+        }
+    }
+
+    table.states.insert(table.states.end(), subset.begin(), subset.end());
+    table.offsets.push_back(table.states.size());
+    insert_slot(table, {hash, num_subsets});
+
+    return num_subsets;
+}
+
+std::pair<usize, bool>
+intern_subset(SubsetTable& table, const std::span<const u32> subset)
+{
+    const u64 hash = hash_subset(subset);
+    const usize id = find_subset(table, subset, hash);
+    if (id != EMPTY_SLOT)
+        return {id, false};
+
+    return {add_subset(table, subset, hash), true};
+}
+
+SymbolClasses
+get_symbol_classes(const Graph& g)
+{
+    /* The signature of a symbol is the list of (source, destination) pairs of its edges */
+    std::array<std::vector<std::pair<u32, u32>>, NUM_CHARS> signatures;
+    for (usize src = 0; src < num_states(g); ++src) {
+        for (auto [dest, symbol] : edges(g, src))
+            signatures[u8(symbol)].emplace_back(u32(src), dest);
+    }
+
+    /* Group the symbols with equal signatures, the smallest symbol of a group leads it */
+    std::vector<usize> symbols;
+    for (usize c = 0; c < NUM_CHARS; ++c) {
+        if (!signatures[c].empty())
+            symbols.push_back(c);
+    }
+    ranges::sort(symbols, [&](usize a, usize b) {
+        return std::tie(signatures[a], a) < std::tie(signatures[b], b);
+    });
+
+    std::array<usize, NUM_CHARS> leader = {};
+    for (usize i = 0; i < symbols.size(); ++i) {
+        const bool same = i > 0 && signatures[symbols[i]] == signatures[symbols[i - 1]];
+        leader[symbols[i]] = same ? leader[symbols[i - 1]] : symbols[i];
+    }
+
+    /* Number the classes in the order of their leaders */
+    SymbolClasses classes{};
+    classes.num_classes = 1;
+    for (usize c = 0; c < NUM_CHARS; ++c) {
+        if (signatures[c].empty())
+            continue;
+
+        if (leader[c] == c)
+            classes.class_of[c] = u8(classes.num_classes++);
+        else
+            classes.class_of[c] = classes.class_of[leader[c]];
+    }
+
+    return classes;
+}
+
+PowersetScratch
+make_powerset_scratch(const Graph& nfa)
+{
+    PowersetScratch scratch{};
+    scratch.words = BITSET_WORDS(num_states(nfa));
+    scratch.classes = get_symbol_classes(nfa);
+    for (usize c = 0; c < NUM_CHARS; ++c) {
+        if (scratch.classes.class_of[c])
+            scratch.symbols.push_back(char(c));
+    }
+    scratch.bits.assign(scratch.classes.num_classes * scratch.words, 0);
+    scratch.touched.assign(scratch.classes.num_classes, false);
+    scratch.class_dest.assign(scratch.classes.num_classes, EMPTY_SLOT);
+
+    return scratch;
+}
+
+template<typename F>
+void
+expand_subset(const Graph& nfa,
+              std::span<const u32> subset,
+              PowersetScratch& scratch,
+              F&& emit)
+{
+    const usize words = scratch.words;
+
+    /* Gather the destination subsets of all symbol classes in a single pass over the edges */
+    for (auto src : subset) {
+        for (auto [dest, symbol] : edges(nfa, src)) {
+            const usize idx = scratch.classes.class_of[u8(symbol)];
+            BITSET_SET(scratch.bits.data() + idx * words, dest);
+            scratch.touched[idx] = true;
+        }
+    }
+
+    /*
+     *  Emit them in the order of the classes. The source subset is not read
+     *  anymore, so `emit` is free to invalidate it.
+     */
+    for (usize idx = 1; idx < scratch.classes.num_classes; ++idx) {
+        if (!scratch.touched[idx])
+            continue;
+        scratch.touched[idx] = false;
+
+        /* Move the destination subset out of its bitset, in sorted order */
+        u64* bits = scratch.bits.data() + idx * words;
+        scratch.dest_subset.clear();
+        for (usize w = 0; w < words; ++w) {
+            for (; bits[w]; bits[w] &= bits[w] - 1)
+                scratch.dest_subset.push_back(
+                    u32(w * WORD_BITS + usize(std::countr_zero(bits[w]))));
+        }
+
+        emit(idx, std::span<const u32>(scratch.dest_subset));
+    }
+}
+
+Graph
+to_dfa_graph(const Graph& nfa)
+{
+    Graph dfa{};
+
+    if (num_states(nfa) == 0)
+        return dfa;
+
+    /*
+     *  Every subset of NFA states is interned in its sorted form, which gives
+     *  it its identifier. Identifiers are handed out in discovery order, so
+     *  they double as the BFS queue.
+     */
+    SubsetTable ids;
+    auto scratch = make_powerset_scratch(nfa);
+
+    const u32 start = u32(nfa.start);
+    intern_subset(ids, {&start, 1});
+    dfa.flags.emplace_back();
+    dfa.flags[0] |= START;
+    dfa.start = 0;
+    if (!nfa.pattern_offsets.empty())
+        dfa.pattern_offsets = {0};
+
+    for (usize src_subset_id = 0; src_subset_id < dfa.flags.size(); ++src_subset_id) {
+        /* Check if this subset will become a final node */
+        for (auto src : get_subset(ids, src_subset_id))
+            dfa.flags[src_subset_id] |= nfa.flags[src] & FINAL;
+        if (!nfa.pattern_offsets.empty()) {
+            add_accepted_patterns(nfa, get_subset(ids, src_subset_id), dfa.patterns);
+            dfa.pattern_offsets.push_back(dfa.patterns.size());
+        }
+
+        /* Determinize the edges of the source subset through each symbol class */
+        auto subset = get_subset(ids, src_subset_id);
+        expand_subset(nfa, subset, scratch, [&](usize idx, std::span<const u32> dest_subset) {
+            /*
+             *  If this subset has not been visited yet, it gets the next
+             *  identifier and is thereby added to the queue.
+             */
+            auto [dest_subset_id, inserted] = intern_subset(ids, dest_subset);
+            if (inserted)
+                dfa.flags.emplace_back();
+
+            scratch.class_dest[idx] = dest_subset_id;
+        });
+
+        /* Create the edges from the source subset, expanding each class back to its symbols */
+        for (char symbol : scratch.symbols) {
+            const usize idx = scratch.classes.class_of[u8(symbol)];
+            if (scratch.class_dest[idx] != EMPTY_SLOT)
+                add_edge(dfa, scratch.class_dest[idx], symbol);
+        }
+        ranges::fill(scratch.class_dest, EMPTY_SLOT);
+        end_state(dfa);
+    }
+
+    return dfa;
+}
+
+Graph
+to_dfa_graph_parallel(const Graph& nfa, const usize num_threads)
+{
+    /*
+     *  Each worker expands subsets taken from the back of its own deque, and
+     *  steals from the front of the other deques when it runs out of work.
+     *  Subsets are interned in a table split into independently locked
+     *  shards, so identifiers are handed out in a nondeterministic order. A
+     *  final BFS renumbers the states as the sequential construction would.
+     *  The workers that find no work sleep until a subset is queued, or
+     *  until the last pending one is expanded.
+     */
+
+    Graph dfa{};
+
+    if (num_states(nfa) == 0)
+        return dfa;
+
+    std::vector<SubsetShard> shards(NUM_SHARDS);
+    std::vector<WorkDeque> deques(num_threads);
+    std::vector<std::vector<ExpandedSubset>> expanded(num_threads);
+    std::atomic<usize> next_id = 0;
+    std::atomic<usize> pending = 0;
+    std::atomic<usize> queued = 0;
+    std::atomic<usize> sleepers = 0;
+    std::mutex idle_lock;
+    std::condition_variable work_ready;
+
+    /* Taking the lock orders the wakeup after the check of a worker about to sleep */
+    auto wake = [&](bool all) {
+        if (!sleepers)
+            return;
+        { std::scoped_lock guard(idle_lock); }
+        if (all)
+            work_ready.notify_all();
+        else
+            work_ready.notify_one();
+    };
+
+    auto intern = [&](std::span<const u32> subset, usize worker) {
+        /* Pick the shard with the high bits of the hash, the table probes with the low ones */
+        const u64 hash = hash_subset(subset);
+        const usize shard_idx = usize(hash >> (64 - std::countr_zero(NUM_SHARDS)));
+        auto& shard = shards[shard_idx];
+
+        usize id;
+        usize local_id;
+        bool inserted;
+        {
+            std::scoped_lock guard(shard.lock);
+            local_id = find_subset(shard.subsets, subset, hash);
+            inserted = local_id == EMPTY_SLOT;
+            if (inserted) {
+                local_id = add_subset(shard.subsets, subset, hash);
+                shard.ids.push_back(next_id++);
+            }
+            id = shard.ids[local_id];
+        }
+
+        if (inserted) {
+            ++pending;
+            {
+                std::scoped_lock guard(deques[worker].lock);
+                deques[worker].items.push_back({id, shard_idx, local_id});
+            }
+            ++queued;
+            wake(false);
+        }
+
+        return id;
+    };
+
+    auto take = [&](usize worker) -> std::optional<WorkItem> {
+        {
+            auto& own = deques[worker];
+            std::scoped_lock guard(own.lock);
+            if (!own.items.empty()) {
+                auto item = own.items.back();
+                own.items.pop_back();
+                --queued;
+                return item;
+            }
+        }
+
+        for (usize i = 1; i < num_threads && queued; ++i) {
+            auto& victim = deques[(worker + i) % num_threads];
+            std::scoped_lock guard(victim.lock);
+            if (!victim.items.empty()) {
+                auto item = victim.items.front();
+                victim.items.pop_front();
+                --queued;
+                return item;
+            }
+        }
+
+        return std::nullopt;
+    };
+
+    auto work = [&](usize worker) {
+        auto scratch = make_powerset_scratch(nfa);
+        std::vector<u32> src_subset;
+
+        /* A subset stays pending until all of its successors have been interned */
+        while (pending) {
+            auto item = take(worker);
+            if (!item) {
+                std::unique_lock guard(idle_lock);
+                ++sleepers;
+                work_ready.wait(guard, [&] { return queued || !pending; });
+                --sleepers;
+                continue;
+            }
+
+            {
+                auto& shard = shards[item->shard];
+                std::scoped_lock guard(shard.lock);
+                auto subset = get_subset(shard.subsets, item->local_id);
+                src_subset.assign(subset.begin(), subset.end());
+            }
+
+            ExpandedSubset result{item->id, 0, {}, {}};
+            for (auto src : src_subset)
+                result.flags |= nfa.flags[src] & FINAL;
+            if (!nfa.pattern_offsets.empty())
+                add_accepted_patterns(nfa, src_subset, result.patterns);
+
+            expand_subset(nfa, src_subset, scratch, [&](usize idx, std::span<const u32> dest) {
+                scratch.class_dest[idx] = intern(dest, worker);
+            });
+
+            for (char symbol : scratch.symbols) {
+                const usize idx = scratch.classes.class_of[u8(symbol)];
+                if (scratch.class_dest[idx] != EMPTY_SLOT)
+                    result.edges.emplace_back(scratch.class_dest[idx], symbol);
+            }
+            ranges::fill(scratch.class_dest, EMPTY_SLOT);
+
+            expanded[worker].push_back(std::move(result));
+            if (--pending == 0)
+                wake(true);
+        }
+    };
+
+    const u32 start = u32(nfa.start);
+    intern({&start, 1}, 0);
+
+    std::vector<std::thread> threads;
+    for (usize worker = 0; worker < num_threads; ++worker)
+        threads.emplace_back(work, worker);
+    for (auto& thread : threads)
+        thread.join();
+
+    /* Renumber the states in the order in which the sequential BFS discovers them */
+    std::vector<const ExpandedSubset*> by_id(next_id);
+    for (auto& results : expanded) {
+        for (auto& result : results)
+            by_id[result.id] = &result;
+    }
+
+    std::vector<usize> new_id(by_id.size(), EMPTY_SLOT);
+    std::vector<usize> order = {0};
+    new_id[0] = 0;
+    dfa.start = 0;
+    if (!nfa.pattern_offsets.empty())
+        dfa.pattern_offsets = {0};
+
+    for (usize i = 0; i < order.size(); ++i) {
+        const auto& result = *by_id[order[i]];
+        dfa.flags.push_back(result.flags);
+        if (!nfa.pattern_offsets.empty()) {
+            const auto& patterns = result.patterns;
+            dfa.patterns.insert(dfa.patterns.end(), patterns.begin(), patterns.end());
+            dfa.pattern_offsets.push_back(dfa.patterns.size());
+        }
+
+        for (auto [dest, symbol] : result.edges) {
+            if (new_id[dest] == EMPTY_SLOT) {
+                new_id[dest] = order.size();
+                order.push_back(dest);
+            }
+
+            add_edge(dfa, new_id[dest], symbol);
+        }
+        end_state(dfa);
+    }
+    dfa.flags[0] |= START;
+
+    return dfa;
+}
+
+Graph
+minimize_dfa_graph(const Graph& dfa)
+{
+    /* Apply Hopcroft's partition refinement algorithm */
+
+    const usize size = num_states(dfa);
+    if (size == 0)
+        return dfa;
+
+    /* Refine over the symbol classes, class 0 (the symbols on no edge) is left out */
+    const auto classes = get_symbol_classes(dfa);
+    std::string sigma;
+    for (usize c = 0; c < NUM_CHARS; ++c) {
+        if (classes.class_of[c])
+            sigma += char(c);
+    }
+
+    /* Complete the DFA with a sink state, so every state has an edge through each class */
+    const usize n = size + 1;
+    const usize k = classes.num_classes - 1;
+    const usize sink = size;
+
+    std::vector<usize> delta(n * k, sink);
+    for (usize src = 0; src < size; ++src) {
+        for (auto [dest, symbol] : edges(dfa, src))
+            delta[src * k + classes.class_of[u8(symbol)] - 1] = dest;
+    }
+
+    /* Inverse edges, grouped by (symbol, destination) */
+    std::vector<usize> inv_offsets(k * n + 1, 0);
+    std::vector<usize> inv(n * k);
+    for (usize q = 0; q < n; ++q) {
+        for (usize a = 0; a < k; ++a)
+            ++inv_offsets[a * n + delta[q * k + a] + 1];
+    }
+    std::partial_sum(inv_offsets.begin(), inv_offsets.end(), inv_offsets.begin());
+    {
+        auto fill = inv_offsets;
+        for (usize q = 0; q < n; ++q) {
+            for (usize a = 0; a < k; ++a)
+                inv[fill[a * n + delta[q * k + a]]++] = q;
+        }
+    }
+
+    /*
+     *  The partition is kept as a permutation of the states in which every
+     *  block occupies a contiguous range. The states of a block that are
+     *  marked during a refinement step are moved to the front of its range.
+     */
+    struct Block {
+        usize begin;
+        usize end;
+        usize marked;
+    };
+
+    std::vector<usize> elems(n);
+    std::vector<usize> loc(n);
+    std::vector<usize> block_of(n);
+    std::vector<Block> blocks;
+
+    /*
+     *  The initial blocks group the states that accept the same patterns of
+     *  a union, or else the final states. The sink accepts nothing.
+     */
+    SubsetTable accept_sets;
+    intern_subset(accept_sets, {});
+    std::vector<usize> key(n, 0);
+    for (usize q = 0; q < size; ++q) {
+        if (!dfa.pattern_offsets.empty())
+            key[q] = intern_subset(accept_sets, accepted_patterns(dfa, q)).first;
+        else
+            key[q] = (dfa.flags[q] & FINAL) != 0;
+    }
+
+    std::vector<usize> key_block(*ranges::max_element(key) + 1, EMPTY_SLOT);
+    for (usize q = 0; q < n; ++q) {
+        if (key_block[key[q]] == EMPTY_SLOT) {
+            key_block[key[q]] = blocks.size();
+            blocks.push_back({0, 0, 0});
+        }
+        block_of[q] = key_block[key[q]];
+        ++blocks[block_of[q]].end;
+    }
+    for (usize b = 0, begin = 0; b < blocks.size(); ++b) {
+        blocks[b].begin = begin;
+        begin += std::exchange(blocks[b].end, begin);
+    }
+    for (usize q = 0; q < n; ++q) {
+        loc[q] = blocks[block_of[q]].end++;
+        elems[loc[q]] = q;
+    }
+
+    /*
+     *  The worklist holds (block, symbol) splitters, encoded as block * k +
+     *  symbol. It starts with all the blocks but the largest one.
+     */
+    std::vector<usize> work;
+    std::vector<bool> in_work(n * k, false);
+    const auto largest = ranges::max_element(
+        blocks, {}, [](const Block& b) { return b.end - b.begin; });
+    for (usize b = 0; b < blocks.size(); ++b) {
+        if (b == usize(largest - blocks.begin()))
+            continue;
+
+        for (usize a = 0; a < k; ++a) {
+            work.push_back(b * k + a);
+            in_work[b * k + a] = true;
+        }
+    }
+
+    std::vector<usize> splitter;
+    std::vector<usize> touched;
+    while (!work.empty()) {
+        const usize item = work.back();
+        work.pop_back();
+        in_work[item] = false;
+
+        const usize a = item % k;
+        const auto& b = blocks[item / k];
+        splitter.assign(elems.begin() + ptrdiff_t(b.begin), elems.begin() + ptrdiff_t(b.end));
+
+        /* Mark every state that reaches the splitter through the symbol */
+        for (auto t : splitter) {
+            for (usize i = inv_offsets[a * n + t]; i < inv_offsets[a * n + t + 1]; ++i) {
+                const usize q = inv[i];
+                auto& y = blocks[block_of[q]];
+                const usize first_unmarked = y.begin + y.marked;
+                if (loc[q] < first_unmarked)
+                    continue;
+
+                const usize other = elems[first_unmarked];
+                std::swap(elems[loc[q]], elems[first_unmarked]);
+                loc[other] = loc[q];
+                loc[q] = first_unmarked;
+
+                if (y.marked++ == 0)
+                    touched.push_back(block_of[q]);
+            }
+        }
+
+        /* Split the blocks that are only partially marked */
+        for (auto y : touched) {
+            const usize marked = std::exchange(blocks[y].marked, 0);
+            if (marked == blocks[y].end - blocks[y].begin)
+                continue;
+
+            const usize z = blocks.size();
+            blocks.push_back({blocks[y].begin, blocks[y].begin + marked, 0});
+            blocks[y].begin += marked;
+            for (usize i = blocks[z].begin; i < blocks[z].end; ++i)
+                block_of[elems[i]] = z;
+
+            const usize y_size = blocks[y].end - blocks[y].begin;
+            for (usize c = 0; c < k; ++c) {
+                usize to_add = z;
+                if (!in_work[y * k + c] && y_size < marked)
+                    to_add = y;
+
+                in_work[to_add * k + c] = true;
+                work.push_back(to_add * k + c);
+            }
+        }
+        touched.clear();
+    }
+
+    /* Renumber the blocks in BFS order from the start block, dropping the sink's block */
+    Graph min_dfa{};
+    const usize npos = usize(-1);
+    const usize sink_block = block_of[sink];
+    const usize start_block = block_of[dfa.start];
+
+    min_dfa.flags.emplace_back(START);
+    min_dfa.start = 0;
+    if (!dfa.pattern_offsets.empty())
+        min_dfa.pattern_offsets = {0};
+    if (start_block == sink_block) {
+        end_state(min_dfa);
+        if (!dfa.pattern_offsets.empty())
+            min_dfa.pattern_offsets.push_back(0);
+        return min_dfa;
+    }
+
+    std::vector<usize> new_id(blocks.size(), npos);
+    std::vector<usize> order = {start_block};
+    new_id[start_block] = 0;
+    for (usize i = 0; i < order.size(); ++i) {
+        const usize rep = elems[blocks[order[i]].begin];
+        min_dfa.flags[i] |= dfa.flags[rep] & FINAL;
+        if (!dfa.pattern_offsets.empty()) {
+            const auto patterns = accepted_patterns(dfa, rep);
+            min_dfa.patterns.insert(min_dfa.patterns.end(), patterns.begin(), patterns.end());
+            min_dfa.pattern_offsets.push_back(min_dfa.patterns.size());
+        }
+
+        for (char symbol : sigma) {
+            const usize a = classes.class_of[u8(symbol)] - 1;
+            const usize dest_block = block_of[delta[rep * k + a]];
+            if (dest_block == sink_block)
+                continue;
+
+            if (new_id[dest_block] == npos) {
+                new_id[dest_block] = order.size();
+                order.push_back(dest_block);
+                min_dfa.flags.emplace_back();
+            }
+
+            add_edge(min_dfa, new_id[dest_block], symbol);
+        }
+        end_state(min_dfa);
+    }
+
+    return min_dfa;
+}
+
+u32
+make_term(TermPool& pool, const Term term)
+{
+    const std::array<u32, 3> key = {
+        u32(term.kind) | u32(u8(term.symbol)) << 8, term.left, term.right};
+    auto [id, inserted] = intern_subset(pool.ids, key);
+    if (inserted)
+        pool.terms.push_back(term);
+
+    return u32(id);
+}
+
+u32
+make_concat(TermPool& pool, const u32 left, const u32 right)
+{
+    if (left == EMPTY_TERM || right == EMPTY_TERM)
+        return EMPTY_TERM;
+    if (left == EPSILON_TERM)
+        return right;
+    if (right == EPSILON_TERM)
+        return left;
+
+    /*
+     *  Concatenations are kept as right-nested chains, re-associating
+     *  (x·y)·z into x·(y·z), so that the left operand of a concatenation is
+     *  never one and the derivatives only rebuild the front of a chain.
+     */
+    std::vector<u32> factors;
+    u32 t = left;
+    for (; pool.terms[t].kind == TermKind::CONCAT; t = pool.terms[t].right)
+        factors.push_back(pool.terms[t].left);
+    factors.push_back(t);
+
+    u32 result = right;
+    for (usize i = factors.size(); i-- > 0;) {
+        const bool nullable = pool.terms[factors[i]].nullable && pool.terms[result].nullable;
+        result = make_term(pool, {TermKind::CONCAT, nullable, S_LAMBDA, factors[i], result});
+    }
+
+    return result;
+}
+
+u32
+make_union(TermPool& pool, std::vector<u32> alternatives)
+{
+    /*
+     *  Unions are kept as right-nested chains whose alternatives are sorted by
+     *  identifier and distinct, which makes them associative, commutative and
+     *  idempotent by construction.
+     */
+    std::vector<u32> flat;
+    for (auto t : alternatives) {
+        for (; pool.terms[t].kind == TermKind::UNION; t = pool.terms[t].right)
+            flat.push_back(pool.terms[t].left);
+        flat.push_back(t);
+    }
+
+    ranges::sort(flat);
+    auto duplicates = ranges::unique(flat);
+    flat.erase(duplicates.begin(), duplicates.end());
+    if (!flat.empty() && flat.front() == EMPTY_TERM)
+        flat.erase(flat.begin());
+
+    if (flat.empty())
+        return EMPTY_TERM;
+
+    u32 result = flat.back();
+    for (usize i = flat.size() - 1; i-- > 0;) {
+        const bool nullable = pool.terms[flat[i]].nullable || pool.terms[result].nullable;
+        result = make_term(pool, {TermKind::UNION, nullable, S_LAMBDA, flat[i], result});
+    }
+
+    return result;
+}
+
+u32
+make_star(TermPool& pool, const u32 inner)
+{
+    if (inner == EMPTY_TERM || inner == EPSILON_TERM)
+        return EPSILON_TERM;
+    if (pool.terms[inner].kind == TermKind::STAR)
+        return inner;
+
+    return make_term(pool, {TermKind::STAR, true, S_LAMBDA, inner, NO_TERM});
+}
+
+u32
+derive(TermPool& pool, const u32 t, const usize symbol_idx)
+{
+    const usize memo_idx = t * pool.alphabet.size() + symbol_idx;
+    if (memo_idx < pool.derivatives.size() && pool.derivatives[memo_idx] != NO_TERM)
+        return pool.derivatives[memo_idx];
+
+    const Term term = pool.terms[t];
+    u32 result = EMPTY_TERM;
+
+    switch (term.kind) {
+    case TermKind::EMPTY:
+    case TermKind::EPSILON:
+        break;
+    case TermKind::SYMBOL:
+        result = term.symbol == pool.alphabet[symbol_idx] ? EPSILON_TERM : EMPTY_TERM;
+        break;
+    case TermKind::CONCAT: {
+        /* Walk the chain while its factors are nullable, rather than recursing into it */
+        std::vector<u32> parts;
+        u32 cur = t;
+        for (; pool.terms[cur].kind == TermKind::CONCAT; cur = pool.terms[cur].right) {
+            const Term factor = pool.terms[cur];
+            const u32 d = derive(pool, factor.left, symbol_idx);
+            parts.push_back(make_concat(pool, d, factor.right));
+            if (!pool.terms[factor.left].nullable)
+                break;
+        }
+        if (pool.terms[cur].kind != TermKind::CONCAT)
+            parts.push_back(derive(pool, cur, symbol_idx));
+        result = make_union(pool, std::move(parts));
+        break;
+    }
+    case TermKind::UNION: {
+        std::vector<u32> parts;
+        u32 cur = t;
+        for (; pool.terms[cur].kind == TermKind::UNION; cur = pool.terms[cur].right)
+            parts.push_back(derive(pool, pool.terms[cur].left, symbol_idx));
+        parts.push_back(derive(pool, cur, symbol_idx));
+        result = make_union(pool, std::move(parts));
+        break;
+    }
+    case TermKind::STAR:
+        result = make_concat(pool, derive(pool, term.left, symbol_idx), t);
+        break;
+    }
+
+    if (pool.derivatives.size() < pool.terms.size() * pool.alphabet.size())
+        pool.derivatives.resize(pool.terms.size() * pool.alphabet.size(), NO_TERM);
+    pool.derivatives[memo_idx] = result;
+
+    return result;
+}
+
+Graph
+get_derivative_dfa_graph(const std::span<const RegexNode> ast,
+                         const std::string_view alphabet)
+{
+    /*
+     *  Apply Brzozowski's derivative construction: every DFA state is a
+     *  (hash-consed) regex term, and the edge through a symbol leads to the
+     *  derivative of the term with respect to that symbol.
+     */
+
+    TermPool pool{};
+    pool.alphabet = alphabet;
+    make_term(pool, {TermKind::EMPTY, false, S_LAMBDA, NO_TERM, NO_TERM});
+    make_term(pool, {TermKind::EPSILON, true, S_LAMBDA, NO_TERM, NO_TERM});
+
+    /*
+     *  The term of node i is terms[i]. The concatenations nested in another
+     *  one get no term: the outermost one gathers all their factors and
+     *  chains them from the right, which a left-nested chain of the parser
+     *  would otherwise rebuild at each node.
+     */
+    std::vector<u8> nested(ast.size(), 0);
+    for (auto [kind, symbol, left, right] : ast) {
+        if (kind == NodeKind::CONCAT)
+            nested[left] = nested[right] = 1;
+    }
+
+    std::vector<u32> terms;
+    std::vector<u32> stack;
+    terms.reserve(ast.size());
+    for (usize i = 0; i < ast.size(); ++i) {
+        auto [kind, symbol, left, right] = ast[i];
+        u32 t;
+
+        if (kind == NodeKind::CONCAT && nested[i]) {
+            t = NO_TERM;
+        } else if (kind == NodeKind::CONCAT) {
+            /* Visit the factors from the right, so they are chained in order */
+            t = EPSILON_TERM;
+            stack.assign({left, right});
+            while (!stack.empty()) {
+                const u32 u = stack.back();
+                stack.pop_back();
+                if (ast[u].kind == NodeKind::CONCAT)
+                    stack.insert(stack.end(), {ast[u].left, ast[u].right});
+                else
+                    t = make_concat(pool, terms[u], t);
+            }
+        } else if (kind == NodeKind::UNION) {
+            t = make_union(pool, {terms[left], terms[right]});
+        } else if (kind != NodeKind::SYMBOL) {
+            const u32 x = terms[left];
+
+            if (kind == NodeKind::STAR)
+                t = make_star(pool, x);
+            else if (kind == NodeKind::PLUS)
+                t = make_concat(pool, x, make_star(pool, x));
+            else
+                t = make_union(pool, {EPSILON_TERM, x});
+        } else {
+            t = make_term(pool, {TermKind::SYMBOL, false, symbol, NO_TERM, NO_TERM});
+        }
+
+        terms.push_back(t);
+    }
+
+    Graph dfa{};
+    std::vector<u32> states = {terms.back()};
+    std::vector<usize> ids(pool.terms.size(), EMPTY_SLOT);
+    ids[states[0]] = 0;
+
+    dfa.flags.emplace_back();
+    dfa.flags[0] |= START;
+    dfa.start = 0;
+
+    for (usize src = 0; src < states.size(); ++src) {
+        if (pool.terms[states[src]].nullable)
+            dfa.flags[src] |= FINAL;
+
+        /* Create edges from the source term through each symbol */
+        for (usize i = 0; i < alphabet.size(); ++i) {
+            const u32 d = derive(pool, states[src], i);
+            if (d == EMPTY_TERM)
+                continue;
+
+            ids.resize(pool.terms.size(), EMPTY_SLOT);
+            if (ids[d] == EMPTY_SLOT) {
+                ids[d] = states.size();
+                states.push_back(d);
+                dfa.flags.emplace_back();
+            }
+
+            add_edge(dfa, ids[d], alphabet[i]);
+        }
+        end_state(dfa);
+    }
+
+    return dfa;
+}
+
+u32
+add_lazy_state(LazyDFA& lazy)
+{
+    /* Cost of a state: its subset, its subset offset, its hash slots, edges and flags */
+    const usize k = lazy.classes.num_classes;
+    const usize cost = lazy.dest_subset.size() * sizeof(u32) + sizeof(usize) +
+                       2 * sizeof(SubsetSlot) + k * sizeof(u32) + sizeof(u32);
+
+    /* A state that is already cached costs nothing, even when the cache is full */
+    const u64 hash = hash_subset(lazy.dest_subset);
+    const usize cached = find_subset(lazy.subsets, lazy.dest_subset, hash);
+    if (cached != EMPTY_SLOT)
+        return u32(cached);
+
+    /* Flush the whole cache when it is full, and start over from the new state */
+    if (lazy.used + cost > lazy.budget && !lazy.flags.empty()) {
+        lazy.subsets = {};
+        lazy.next.clear();
+        lazy.flags.clear();
+        lazy.used = 0;
+        ++lazy.num_flushes;
+    }
+
+    const usize id = add_subset(lazy.subsets, lazy.dest_subset, hash);
+    lazy.used += cost;
+    lazy.next.resize(lazy.next.size() + k, UNKNOWN_STATE);
+    lazy.flags.emplace_back();
+    for (auto u : lazy.dest_subset)
+        lazy.flags[id] |= lazy.nfa->flags[u] & FINAL;
+
+    return u32(id);
+}
+
+u32
+step_lazy_dfa(LazyDFA& lazy, const u32 src, const usize class_idx)
+{
+    const usize k = lazy.classes.num_classes;
+    if (lazy.next[src * k + class_idx] != UNKNOWN_STATE)
+        return lazy.next[src * k + class_idx];
+
+    /* Determinize the edge through the symbol class */
+    const usize words = BITSET_WORDS(num_states(*lazy.nfa));
+    lazy.bits.resize(words, 0);
+
+    bool empty = true;
+    for (auto u : get_subset(lazy.subsets, src)) {
+        for (auto [v, to_v] : edges(*lazy.nfa, u)) {
+            if (lazy.classes.class_of[u8(to_v)] == class_idx) {
+                BITSET_SET(lazy.bits.data(), v);
+                empty = false;
+            }
+        }
+    }
+
+    if (empty) {
+        lazy.next[src * k + class_idx] = DEAD_STATE;
+        return DEAD_STATE;
+    }
+
+    lazy.dest_subset.clear();
+    for (usize w = 0; w < words; ++w) {
+        for (; lazy.bits[w]; lazy.bits[w] &= lazy.bits[w] - 1)
+            lazy.dest_subset.push_back(
+                u32(w * WORD_BITS + usize(std::countr_zero(lazy.bits[w]))));
+    }
+
+    const usize flushes = lazy.num_flushes;
+    const u32 dest = add_lazy_state(lazy);
+    if (flushes == lazy.num_flushes)
+        lazy.next[src * k + class_idx] = dest;
+
+    return dest;
+}
+
+bool
+match_lazy_dfa(LazyDFA& lazy, const std::string_view input)
+{
+    /*
+     *  Run the DFA while building it on demand from the NFA. Each symbol of
+     *  the input costs at most one determinization step, and the cache never
+     *  grows past its budget, so both time and memory stay bounded.
+     */
+
+    if (num_states(*lazy.nfa) == 0)
+        return false;
+
+    lazy.dest_subset = {u32(lazy.nfa->start)};
+    u32 state = add_lazy_state(lazy);
+
+    /* Class 0 holds the bytes that appear on no edge of the NFA */
+    for (char c : input) {
+        const usize class_idx = lazy.classes.class_of[u8(c)];
+        if (class_idx == 0)
+            return false;
+
+        state = step_lazy_dfa(lazy, state, class_idx);
+        if (state == DEAD_STATE)
+            return false;
+    }
+
+    return lazy.flags[state] & FINAL;
+}
+
+DenseDFA
+make_dense_dfa(const Graph& g)
+{
+    DenseDFA dfa{};
+    dfa.classes = get_symbol_classes(g);
+
+    /* The dead state comes after the states of the graph, and loops on itself */
+    const usize size = num_states(g);
+    const usize k = dfa.classes.num_classes;
+    dfa.dead = u32(size * k);
+    dfa.start = size ? u32(g.start * k) : dfa.dead;
+    dfa.table.assign((size + 1) * k, dfa.dead);
+    dfa.accept.assign(size + 1, false);
+
+    for (usize src = 0; src < size; ++src) {
+        dfa.accept[src] = (g.flags[src] & FINAL) != 0;
+        for (auto [dest, symbol] : edges(g, src))
+            dfa.table[src * k + dfa.classes.class_of[u8(symbol)]] = u32(dest * k);
+    }
+
+    if (!g.pattern_offsets.empty()) {
+        dfa.pattern_offsets = g.pattern_offsets;
+        dfa.pattern_offsets.push_back(g.patterns.size());
+        dfa.patterns = g.patterns;
+    }
+
+    return dfa;
+}
+
+DenseDFAView
+view_dense_dfa(const DenseDFA& dfa)
+{
+    return {dfa.classes.class_of.data(),
+            dfa.table.data(),
+            dfa.accept.data(),
+            u32(dfa.classes.num_classes),
+            dfa.start,
+            dfa.dead};
+}
+
+u32
+run_dense_dfa(const DenseDFAView& dfa, const std::string_view input)
+{
+    /* Return the identifier of the state reached at the end of the input */
+    u32 state = dfa.start;
+    for (char c : input) {
+        state = dfa.table[state + dfa.class_of[u8(c)]];
+        if (state == dfa.dead)
+            break;
+    }
+
+    return state;
+}
+
+bool
+match_dense_dfa(const DenseDFAView& dfa, const std::string_view input)
+{
+    return dfa.accept[run_dense_dfa(dfa, input) / dfa.num_classes];
+}
+
+bool
+write_dfa_file(const DenseDFA& dfa, const std::string_view key, FILE* output)
+{
+    /* Every section starts on a multiple of 64 bytes, so the tables are cache line aligned */
+    const auto align = [](usize offset) { return (offset + 63) / 64 * 64; };
+
+    DFAFileHeader header{};
+    header.magic = DFA_FILE_MAGIC;
+    header.version = DFA_FILE_VERSION;
+    header.num_states = u32(dfa.accept.size());
+    header.num_classes = u32(dfa.classes.num_classes);
+    header.start = dfa.start;
+    header.dead = dfa.dead;
+    header.class_offset = align(sizeof(header));
+    header.table_offset = align(header.class_offset + NUM_CHARS);
+    header.accept_offset = align(header.table_offset + dfa.table.size() * sizeof(u32));
+    header.size = align(header.accept_offset + dfa.accept.size());
+    if (!key.empty()) {
+        header.key_offset = header.size;
+        header.size = align(header.key_offset + sizeof(u64) + key.size());
+    }
+
+    /* Lay the file out in words, so that the payload can be hashed as such */
+    std::vector<u32> words(header.size / sizeof(u32), 0);
+    auto* bytes = reinterpret_cast<u8*>(words.data());
+    ranges::copy(dfa.classes.class_of, bytes + header.class_offset);
+    ranges::copy(dfa.table, words.begin() + ptrdiff_t(header.table_offset / sizeof(u32)));
+    ranges::copy(dfa.accept, bytes + header.accept_offset);
+    if (!key.empty()) {
+        const u64 key_size = key.size();
+        std::memcpy(bytes + header.key_offset, &key_size, sizeof(key_size));
+        ranges::copy(key, bytes + header.key_offset + sizeof(key_size));
+    }
+
+    const auto payload = std::span<const u32>(words).subspan(sizeof(header) / sizeof(u32));
+    header.checksum = hash_subset(payload);
+    std::memcpy(words.data(), &header, sizeof(header));
+
+    return fwrite(words.data(), sizeof(u32), words.size(), output) == words.size();
+}
+
+std::optional<MappedDFA>
+map_dfa_file(const char* path, const char*& error)
+{
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        error = strerror(errno);
+        return std::nullopt;
+    }
+
+    struct stat st;
+    const bool ok = fstat(fd, &st) == 0;
+    const usize size = ok ? usize(st.st_size) : 0;
+    void* data = ok && size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (!ok || data == MAP_FAILED)
+        error = size || !ok ? strerror(errno) : "empty file";
+    close(fd);
+    if (!ok || data == MAP_FAILED)
+        return std::nullopt;
+
+    MappedDFA mapped{data, size, {}, {}};
+    const auto fail = [&](const char* reason) {
+        error = reason;
+        unmap_dfa_file(mapped);
+        return std::nullopt;
+    };
+
+    /* Check the header before trusting any offset, then the checksum of the payload */
+    const auto* header = static_cast<const DFAFileHeader*>(data);
+    if (size < sizeof(*header) || header->magic != DFA_FILE_MAGIC)
+        return fail("not a DFA file, or written with another byte order");
+    if (header->version != DFA_FILE_VERSION)
+        return fail("unsupported DFA file version");
+
+    /* A section fits if it starts past the header and its length fits in what follows it */
+    const u64 num_states = header->num_states;
+    const u64 k = header->num_classes;
+    const auto fits = [&](u64 offset, u64 length) {
+        return offset >= sizeof(*header) && offset <= size && length <= size - offset;
+    };
+    const bool valid_layout =
+        header->size == size && size % sizeof(u64) == 0 && num_states > 0 && k > 0 &&
+        k <= NUM_CHARS && fits(header->class_offset, NUM_CHARS) &&
+        header->table_offset % sizeof(u32) == 0 &&
+        fits(header->table_offset, num_states * k * sizeof(u32)) &&
+        fits(header->accept_offset, num_states) && header->start < num_states * k &&
+        header->start % k == 0 && header->dead < num_states * k && header->dead % k == 0 &&
+        (header->key_offset == 0 ||
+         (header->key_offset % sizeof(u64) == 0 && fits(header->key_offset, sizeof(u64))));
+    if (!valid_layout)
+        return fail("corrupted DFA file header");
+
+    const auto* base = static_cast<const u8*>(data);
+    const auto payload = std::span(reinterpret_cast<const u32*>(base + sizeof(*header)),
+                                   (size - sizeof(*header)) / sizeof(u32));
+
+    /*
+     *  The tables are indexed by the entries without any check while matching,
+     *  so every entry must be the identifier of a state. Check them in the
+     *  pass over the payload that computes its checksum.
+     */
+    const usize table_begin = (header->table_offset - sizeof(*header)) / sizeof(u32);
+    const usize num_entries = num_states * k;
+    bool valid_entries = true;
+    const u64 checksum = hash_words(payload, [&](usize i, u32 entry) {
+        if (i - table_begin < num_entries)
+            valid_entries &= entry < num_entries && entry % k == 0;
+    });
+    if (checksum != header->checksum)
+        return fail("checksum mismatch");
+    if (!valid_entries)
+        return fail("corrupted DFA file table");
+
+    mapped.dfa = {base + header->class_offset,
+                  reinterpret_cast<const u32*>(base + header->table_offset),
+                  base + header->accept_offset,
+                  u32(k),
+                  header->start,
+                  header->dead};
+    const auto classes = std::span(mapped.dfa.class_of, NUM_CHARS);
+    if (ranges::any_of(classes, [&](u8 c) { return c >= k; }))
+        return fail("corrupted DFA file classes");
+
+    if (header->key_offset) {
+        u64 key_size;
+        std::memcpy(&key_size, base + header->key_offset, sizeof(key_size));
+        if (key_size > size - header->key_offset - sizeof(key_size))
+            return fail("corrupted DFA file key");
+        const auto* key = reinterpret_cast<const char*>(base + header->key_offset);
+        mapped.key = {key + sizeof(key_size), key_size};
+    }
+
+    return mapped;
+}
+
+void
+unmap_dfa_file(MappedDFA& mapped)
+{
+    munmap(mapped.data, mapped.size);
+    mapped = {};
+}
+
+Graph
+get_dense_dfa_graph(const DenseDFAView& dfa)
+{
+    /* The dead state is the last one, and is left out as make_dense_dfa added it */
+    const usize k = dfa.num_classes;
+    const usize size = dfa.dead / k;
+
+    Graph g{};
+    g.start = dfa.start / k;
+    g.flags.assign(size, 0);
+    for (usize src = 0; src < size; ++src) {
+        for (usize c = 0; c < NUM_CHARS; ++c) {
+            const u32 dest = dfa.table[src * k + dfa.class_of[c]];
+            if (dest != dfa.dead)
+                add_edge(g, dest / k, char(c));
+        }
+        end_state(g);
+
+        if (dfa.accept[src])
+            g.flags[src] |= FINAL;
+    }
+    if (size)
+        g.flags[g.start] |= START;
+
+    return g;
+}
+
+std::string
+get_cache_key(const Context& ctx, const std::string_view regex)
+{
+    /*
+     *  The key covers everything that changes the DFA: the regex, the
+     *  alphabet, the options of the pipeline and the file format.
+     */
+    std::string key;
+    key += char('0' + DFA_FILE_VERSION);
+    key += char('0' + u8(ctx.construction));
+    key += ctx.minimize ? 'm' : '-';
+    key += ctx.alphabet;
+    key += '\0';
+    key += regex;
+
+    return key;
+}
+
+std::string
+get_cache_path(const Context& ctx, const std::string_view key)
+{
+    /*
+     *  Name the entry after the hash of the key, packed in words to be hashed
+     *  like subsets. Entries store their key, since two keys may collide.
+     */
+    std::vector<u32> words((key.size() + sizeof(u32) - 1) / sizeof(u32), 0);
+    std::memcpy(words.data(), key.data(), key.size());
+    words.push_back(u32(key.size()));
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016lx.dfa", hash_subset(words));
+    return std::string(ctx.cache_dir) + "/" + name;
+}
+
+bool
+store_cached_dfa(const char* cache_dir,
+                 const std::string& path,
+                 const std::string_view key,
+                 const DenseDFA& dfa)
+{
+    /* Write to a unique file of the same directory, then rename it over the entry at once */
+    if (mkdir(cache_dir, 0777) != 0 && errno != EEXIST)
+        return false;
+
+    std::string tmp_path = path + ".XXXXXX";
+    const int fd = mkstemp(tmp_path.data());
+    if (fd < 0)
+        return false;
+    fchmod(fd, 0644);
+
+    FILE* file = fdopen(fd, "wb");
+    if (!file) {
+        close(fd);
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    const bool written = write_dfa_file(dfa, key, file);
+    if (fclose(file) != 0 || !written || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+Graph
+get_search_nfa_graph(const Graph& nfa)
+{
+    /*
+     *  Prepend Σ* to the λ-free NFA: a new start state loops on every byte
+     *  and has the edges of the old one, so a match may begin anywhere.
+     */
+    Graph g{};
+    for (usize c = 0; c < NUM_CHARS; ++c)
+        add_edge(g, 0, char(c));
+    for (auto [dest, symbol] : edges(nfa, nfa.start))
+        add_edge(g, dest + 1, symbol);
+    end_state(g);
+    g.flags.push_back(START | (nfa.flags[nfa.start] & FINAL));
+    g.start = 0;
+
+    for (usize u = 0; u < num_states(nfa); ++u) {
+        for (auto [dest, symbol] : edges(nfa, u))
+            add_edge(g, dest + 1, symbol);
+        end_state(g);
+        g.flags.push_back(nfa.flags[u] & FINAL);
+    }
+
+    return g;
+}
+
+Graph
+get_reverse_prefix_graph(const Graph& nfa)
+{
+    /*
+     *  Reverse the states that are both reachable and able to reach a final
+     *  state. A new start state has the edges of all of them, since every
+     *  one ends a prefix of a match, and the old start state becomes final.
+     */
+    const usize size = num_states(nfa);
+    std::vector<u8> reached(size, 0);
+    std::vector<u8> live(size, 0);
+    std::vector<usize> stack = {nfa.start};
+    reached[nfa.start] = 1;
+    while (!stack.empty()) {
+        const usize u = stack.back();
+        stack.pop_back();
+        for (auto [dest, symbol] : edges(nfa, u)) {
+            if (!reached[dest]) {
+                reached[dest] = 1;
+                stack.push_back(dest);
+            }
+        }
+    }
+
+    std::vector<Edge> edge_list;
+    for (usize u = 0; u < size; ++u) {
+        for (auto [dest, symbol] : edges(nfa, u))
+            edge_list.push_back({dest, u32(u), symbol});
+    }
+    const Graph reversed = make_graph(size, edge_list);
+    for (usize u = 0; u < size; ++u) {
+        if (reached[u] && (nfa.flags[u] & FINAL)) {
+            live[u] = 1;
+            stack.push_back(u);
+        }
+    }
+    while (!stack.empty()) {
+        const usize u = stack.back();
+        stack.pop_back();
+        for (auto [dest, symbol] : edges(reversed, u)) {
+            if (reached[dest] && !live[dest]) {
+                live[dest] = 1;
+                stack.push_back(dest);
+            }
+        }
+    }
+
+    edge_list.clear();
+    for (usize u = 0; u < size; ++u) {
+        if (!live[u])
+            continue;
+
+        for (auto [dest, symbol] : edges(reversed, u)) {
+            if (live[dest]) {
+                edge_list.push_back({u32(u), dest, symbol});
+                edge_list.push_back({u32(size), dest, symbol});
+            }
+        }
+    }
+
+    Graph g = make_graph(size + 1, edge_list);
+    g.start = size;
+    g.flags[size] = START | FINAL;
+    g.flags[nfa.start] |= FINAL;
+
+    return g;
+}
+
+ScanDFA
+make_scan_dfa(const Graph& g)
+{
+    /* Number the other states first, then the dead state, then the final states */
+    const usize size = num_states(g);
+    std::vector<usize> number(size);
+    usize next = 0;
+    for (usize u = 0; u < size; ++u) {
+        if (!(g.flags[u] & FINAL))
+            number[u] = next++;
+    }
+    const usize dead = next++;
+    const usize first_accept = next;
+    for (usize u = 0; u < size; ++u) {
+        if (g.flags[u] & FINAL)
+            number[u] = next++;
+    }
+
+    ScanDFA dfa{};
+    dfa.classes = get_symbol_classes(g);
+    const usize k = dfa.classes.num_classes;
+    dfa.table.assign((size + 1) * k, u32(dead * k));
+    dfa.start = u32(number[g.start] * k);
+    dfa.dead = u32(dead * k);
+    dfa.first_accept = u32(first_accept * k);
+
+    for (usize src = 0; src < size; ++src) {
+        for (auto [dest, symbol] : edges(g, src)) {
+            const usize c = dfa.classes.class_of[u8(symbol)];
+            dfa.table[number[src] * k + c] = u32(number[dest] * k);
+        }
+    }
+
+    return dfa;
+}
+
+const u8*
+find_literal(const u8* const begin, const u8* const end, const std::string_view literal)
+{
+    /*
+     *  Compare a whole vector of positions at once with the first and the
+     *  last byte of the literal, and only check the middle of the positions
+     *  where both match. The remaining positions are left to memmem.
+     */
+    const usize n = literal.size();
+    if (n == 1)
+        return static_cast<const u8*>(memchr(begin, literal[0], usize(end - begin)));
+    if (usize(end - begin) < n)
+        return nullptr;
+
+    const u8* p = begin;
+    const auto check = [&](u32 mask) -> const u8* {
+        for (; mask; mask &= mask - 1) {
+            const u8* candidate = p + std::countr_zero(mask);
+            if (!memcmp(candidate + 1, literal.data() + 1, n - 2))
+                return candidate;
+        }
+        return nullptr;
+    };
+#if defined(__AVX2__)
+    const __m256i first = _mm256_set1_epi8(literal[0]);
+    const __m256i last = _mm256_set1_epi8(literal[n - 1]);
+    for (; usize(end - p) >= n - 1 + 32; p += 32) {
+        const auto* block = reinterpret_cast<const __m256i*>(p);
+        const auto* block_last = reinterpret_cast<const __m256i*>(p + n - 1);
+        const __m256i eq_first = _mm256_cmpeq_epi8(_mm256_loadu_si256(block), first);
+        const __m256i eq_last = _mm256_cmpeq_epi8(_mm256_loadu_si256(block_last), last);
+        const __m256i eq = _mm256_and_si256(eq_first, eq_last);
+        if (const u8* found = check(u32(_mm256_movemask_epi8(eq))))
+            return found;
+    }
+#elif defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(literal[0]);
+    const __m128i last = _mm_set1_epi8(literal[n - 1]);
+    for (; usize(end - p) >= n - 1 + 16; p += 16) {
+        const auto* block = reinterpret_cast<const __m128i*>(p);
+        const auto* block_last = reinterpret_cast<const __m128i*>(p + n - 1);
+        const __m128i eq_first = _mm_cmpeq_epi8(_mm_loadu_si128(block), first);
+        const __m128i eq_last = _mm_cmpeq_epi8(_mm_loadu_si128(block_last), last);
+        const __m128i eq = _mm_and_si128(eq_first, eq_last);
+        if (const u8* found = check(u32(_mm_movemask_epi8(eq))))
+            return found;
+    }
+#endif
+    (void)check;
+
+    return static_cast<const u8*>(memmem(p, usize(end - p), literal.data(), n));
+}
+
+bool
+scan_line(const ScanDFA& dfa, const u8* begin, const u8* const end)
+{
+    /* The line matches as soon as an accepting state is reached, even before any byte */
+    u32 state = dfa.start;
+    while (state < dfa.first_accept && begin != end)
+        state = dfa.table[state + dfa.classes.class_of[*begin++]];
+
+    return state >= dfa.first_accept;
+}
+
+u32
+scan_offsets(Scanner& scanner, u32 state, const u8* const begin, const u8* const end)
+{
+    /*
+     *  Report the end of every match, and restart from the start state after
+     *  it, so the matches reported are the earliest non-overlapping ones. The
+     *  state is carried over from the previous block.
+     */
+    const auto& dfa = *scanner.dfa;
+    for (const u8* p = begin; p != end; ++p) {
+        state = dfa.table[state + dfa.classes.class_of[*p]];
+        if (state < dfa.first_accept)
+            continue;
+
+        report_offset(scanner, scanner.num_bytes + usize(p + 1 - begin));
+        state = dfa.start;
+    }
+
+    return state;
+}
+
+void
+scan_offsets_filtered(Scanner& scanner, const u8* const begin, const u8* const end)
+{
+    /*
+     *  Scan a whole input from the start state, as scan_offsets would, but
+     *  only around the occurrences of the literal. The matches after the
+     *  position p contain an occurrence at or after the next one, so they
+     *  start after the prefixes read backward from it, and end after it.
+     *  The DFA then runs forward from there until it is back in its start
+     *  state past the occurrence, where no match is in progress anymore.
+     */
+    const auto& dfa = *scanner.dfa;
+    const auto& reverse = scanner.filter->reverse;
+    const std::string_view literal = scanner.filter->literal;
+    const u8* p = begin;
+
+    while (const u8* hit = find_literal(p, end, literal)) {
+        const u8* from = hit;
+        u32 state = reverse.start;
+        for (const u8* q = hit; q != p && state != reverse.dead;) {
+            state = reverse.table[state + reverse.classes.class_of[*--q]];
+            if (state >= reverse.first_accept)
+                from = q;
+        }
+
+        const u8* const earliest_end = hit + literal.size();
+        state = dfa.start;
+        for (p = from; p != end && (p < earliest_end || state != dfa.start);) {
+            state = dfa.table[state + dfa.classes.class_of[*p++]];
+            if (state >= dfa.first_accept) {
+                report_offset(scanner, scanner.num_bytes + usize(p - begin));
+                state = dfa.start;
+            }
+        }
+    }
+}
+
+void
+report_offset(Scanner& scanner, const usize offset)
+{
+    if (scanner.name)
+        fprintf(scanner.output, "%s:", scanner.name);
+    fprintf(scanner.output, "%zu\n", offset);
+    ++scanner.num_matches;
+}
+
+void
+scan_lines(Scanner& scanner, const u8* begin, const u8* const end)
+{
+    /*
+     *  Report the lines that contain a match, the last one may lack its
+     *  newline. With a prefilter, only the lines with an occurrence of the
+     *  literal are run through the DFA, and the others are skipped. When
+     *  the first window shows that it skips less than a quarter of the bytes,
+     *  the lines are all scanned instead, which saves a search per line.
+     */
+    const u8* const first = begin;
+    bool filtered = scanner.filter != nullptr;
+    usize skipped = 0;
+    while (begin != end) {
+        if (filtered && usize(begin - first) >= PREFILTER_WINDOW)
+            filtered = 4 * skipped >= usize(begin - first);
+
+        if (filtered) {
+            const u8* hit = find_literal(begin, end, scanner.filter->literal);
+            if (!hit)
+                break;
+
+            const usize before = usize(hit - begin);
+            const auto* newline = static_cast<const u8*>(memrchr(begin, '\n', before));
+            skipped += newline ? usize(newline + 1 - begin) : 0;
+            begin = newline ? newline + 1 : begin;
+        }
+
+        const auto* newline = static_cast<const u8*>(memchr(begin, '\n', usize(end - begin)));
+        const u8* line_end = newline ? newline : end;
+
+        if (scan_line(*scanner.dfa, begin, line_end)) {
+            if (scanner.name)
+                fprintf(scanner.output, "%s:", scanner.name);
+            fwrite(begin, 1, usize(line_end - begin), scanner.output);
+            fputc('\n', scanner.output);
+            ++scanner.num_matches;
+        }
+
+        begin = newline ? newline + 1 : end;
+    }
+}
+
+void
+scan_block(Scanner& scanner, const u8* const begin, const u8* const end)
+{
+    /* A block that ends the input, from the start state */
+    if (scanner.num_threads > 1 && usize(end - begin) > SCAN_CHUNK_BYTES &&
+        !(scanner.offsets && scanner.filter))
+        scan_parallel(scanner, begin, end);
+    else if (scanner.offsets && scanner.filter)
+        scan_offsets_filtered(scanner, begin, end);
+    else if (scanner.offsets)
+        scan_offsets(scanner, scanner.dfa->start, begin, end);
+    else
+        scan_lines(scanner, begin, end);
+    scanner.num_bytes += usize(end - begin);
+}
+
+u32
+converge_scan(const ScanDFA& dfa, const u8*& p, const u8* const end)
+{
+    /*
+     *  Run the DFA from every state it may be in between two bytes, that is
+     *  all but the dead and the accepting ones since it restarts after a
+     *  match, until the runs meet in a single state. From there the scan no
+     *  longer depends on the state it started in. Returns that state, or
+     *  UNKNOWN_STATE if the runs have not met within CONVERGE_BYTES.
+     */
+    std::vector<u32> lanes;
+    for (usize state = 0; state < dfa.dead; state += dfa.classes.num_classes)
+        lanes.push_back(u32(state));
+
+    const u8* const window_end = p + std::min(CONVERGE_BYTES, usize(end - p));
+    while (lanes.size() > 1 && p != window_end) {
+        const u8* const stop = p + std::min(CONVERGE_STEP, usize(window_end - p));
+        for (auto& state : lanes) {
+            for (const u8* q = p; q != stop; ++q) {
+                state = dfa.table[state + dfa.classes.class_of[*q]];
+                if (state >= dfa.first_accept)
+                    state = dfa.start;
+            }
+        }
+        p = stop;
+
+        std::sort(lanes.begin(), lanes.end());
+        lanes.erase(std::unique(lanes.begin(), lanes.end()), lanes.end());
+    }
+
+    return lanes.size() == 1 ? lanes[0] : UNKNOWN_STATE;
+}
+
+ssize_t
+write_chunk_output(void* cookie, const char* data, const size_t size)
+{
+    /* Buffer the reports of a chunk, and write them once they fill the buffer and may be */
+    auto& [scan, index] = *static_cast<ChunkOutput*>(cookie);
+    auto& chunk = scan->chunks[index];
+    chunk.output.append(data, size);
+    if (chunk.output.size() >= SCAN_OUTPUT_BYTES) {
+        {
+            std::unique_lock guard(scan->lock);
+            scan->changed.wait(guard, [&] { return scan->turn == index; });
+        }
+        flush_chunk(*scan, index);
+    }
+
+    return ssize_t(size);
+}
+
+void
+flush_chunk(ParallelScan& scan, const usize index)
+{
+    /*
+     *  Write the reports of the chunk whose turn it is. The bytes before the
+     *  point of convergence are scanned first, from the state the previous
+     *  chunk ends in, which is known since that chunk is written.
+     */
+    auto& chunk = scan.chunks[index];
+    const Scanner& scanner = *scan.scanner;
+    if (!chunk.started && chunk.converged != chunk.begin) {
+        Scanner prefix = scanner;
+        prefix.num_matches = 0;
+        prefix.num_bytes = scanner.num_bytes + usize(chunk.begin - scan.input);
+        const u32 entry = scan.chunks[index - 1].exit;
+        scan_offsets(prefix, entry, chunk.begin, chunk.converged);
+        chunk.num_matches += prefix.num_matches;
+    }
+    chunk.started = true;
+
+    fwrite(chunk.output.data(), 1, chunk.output.size(), scanner.output);
+    chunk.output.clear();
+}
+
+void
+write_chunks(ParallelScan& scan, std::unique_lock<std::mutex>& guard)
+{
+    /* Write the chunks that are done from the turn on, by the thread that owns the turn */
+    while (scan.turn < scan.chunks.size() && scan.chunks[scan.turn].done) {
+        const usize index = scan.turn;
+        guard.unlock();
+        flush_chunk(scan, index);
+        std::string().swap(scan.chunks[index].output);
+        guard.lock();
+
+        ++scan.turn;
+        scan.changed.notify_all();
+    }
+}
+
+void
+scan_chunk(ParallelScan& scan, const usize index)
+{
+    /*
+     *  The lines of a chunk are scanned as a whole. The offsets are scanned
+     *  past the point where the runs from every state converge, and the
+     *  bytes before it once the chunk is written. When the runs do not
+     *  converge, the whole chunk is scanned from the state the previous one
+     *  ends in, as soon as that chunk knows it. The reports are buffered in
+     *  the output of the chunk, which is written when it fills up and the
+     *  chunks before it are written.
+     */
+    auto& chunk = scan.chunks[index];
+    const Scanner& scanner = *scan.scanner;
+    const auto& dfa = *scanner.dfa;
+    ChunkOutput cookie{&scan, index};
+    Scanner worker = scanner;
+    worker.output = fopencookie(&cookie, "w", {nullptr, write_chunk_output, nullptr, nullptr});
+    worker.num_matches = 0;
+    worker.buffer = nullptr;
+    worker.buffer_size = 0;
+
+    const u8* p = chunk.begin;
+    u32 state = dfa.start;
+    if (!worker.output) {
+        /* Without its own output, the chunk is scanned once the ones before it are written */
+        worker.output = scanner.output;
+        std::unique_lock guard(scan.lock);
+        scan.changed.wait(guard, [&] { return scan.turn == index; });
+        state = index ? scan.chunks[index - 1].exit : dfa.start;
+        chunk.started = true;
+    } else if (scanner.offsets && index > 0) {
+        state = converge_scan(dfa, p, chunk.end);
+        if (state == UNKNOWN_STATE) {
+            p = chunk.begin;
+            std::unique_lock guard(scan.lock);
+            auto& previous = scan.chunks[index - 1];
+            scan.changed.wait(guard, [&] { return previous.exit != UNKNOWN_STATE; });
+            state = previous.exit;
+        }
+    }
+    chunk.converged = p;
+
+    /* The state the chunk ends in is published before its reports are written */
+    if (scanner.offsets) {
+        worker.num_bytes = scanner.num_bytes + usize(p - scan.input);
+        state = scan_offsets(worker, state, p, chunk.end);
+        std::scoped_lock guard(scan.lock);
+        chunk.exit = state;
+        scan.changed.notify_all();
+    } else {
+        scan_lines(worker, p, chunk.end);
+    }
+
+    if (worker.output != scanner.output)
+        fclose(worker.output);
+
+    std::unique_lock guard(scan.lock);
+    chunk.num_matches += worker.num_matches;
+    chunk.done = true;
+    if (scan.turn == index)
+        write_chunks(scan, guard);
+}
+
+void
+scan_parallel(Scanner& scanner, const u8* const begin, const u8* const end)
+{
+    /*
+     *  Split a mapped file in chunks, scanned by a pool of workers, which
+     *  write their reports in order. The lines are independent, so the
+     *  chunks end after a newline. For the offsets, the function from the
+     *  state a chunk starts in to the state it ends in becomes constant once
+     *  the runs from every state converge, so composing them in order only
+     *  scans again the bytes before convergence, and a chunk that does not
+     *  converge only waits for the state the previous one ends in. The
+     *  reports are exactly those of a sequential scan.
+     */
+    const Scanner job = scanner;
+    ParallelScan scan{
+        .scanner = &job, .input = begin, .chunks = {}, .lock = {}, .changed = {}};
+    for (const u8* p = begin; p != end;) {
+        const u8* next = p + std::min(SCAN_CHUNK_BYTES, usize(end - p));
+        if (!scanner.offsets && next != end) {
+            const auto* newline =
+                static_cast<const u8*>(memchr(next, '\n', usize(end - next)));
+            next = newline ? newline + 1 : end;
+        }
+        scan.chunks.push_back({.begin = p, .end = next});
+        p = next;
+    }
+
+    /* At most two chunks per worker are scanned ahead of the turn, to bound their outputs */
+    const usize num_chunks = scan.chunks.size();
+    const usize num_workers = std::min(scanner.num_threads, num_chunks);
+    std::atomic<usize> next = 0;
+    auto work = [&]() {
+        for (usize i; (i = next.fetch_add(1, std::memory_order_relaxed)) < num_chunks;) {
+            {
+                std::unique_lock guard(scan.lock);
+                scan.changed.wait(guard, [&] { return i < scan.turn + 2 * num_workers; });
+            }
+            scan_chunk(scan, i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (usize worker = 0; worker < num_workers; ++worker)
+        threads.emplace_back(work);
+    for (auto& thread : threads)
+        thread.join();
+
+    for (const auto& chunk : scan.chunks)
+        scanner.num_matches += chunk.num_matches;
+}
+
+bool
+scan_mapped(Scanner& scanner, const int fd, const usize size)
+{
+    /*
+     *  Run the DFA over the page cache directly rather than over a copy. The
+     *  advice lets the kernel read ahead aggressively and drop the pages once
+     *  they are scanned; huge pages are only a hint, honoured by the file
+     *  systems that cache files in large folios.
+     */
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return false;
+
+    madvise(data, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(data, size, MADV_HUGEPAGE);
+#endif
+
+    const auto* begin = static_cast<const u8*>(data);
+    scan_block(scanner, begin, begin + size);
+    munmap(data, size);
+    return true;
+}
+
+bool
+grow_scan_buffer(Scanner& scanner, const usize min_size)
+{
+    usize size = scanner.buffer_size ? scanner.buffer_size : SCAN_BLOCK_BYTES;
+    while (size < min_size)
+        size *= 2;
+    if (size == scanner.buffer_size)
+        return true;
+
+    void* buffer =
+        scanner.buffer
+            ? mremap(scanner.buffer, scanner.buffer_size, size, MREMAP_MAYMOVE)
+            : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED)
+        return false;
+
+    scanner.buffer = static_cast<u8*>(buffer);
+    scanner.buffer_size = size;
+    return true;
+}
+
+bool
+scan_stream(Scanner& scanner, const int fd)
+{
+    /*
+     *  Read the input in large blocks, at page-aligned offsets of the buffer.
+     *  The line that straddles two blocks is moved just before the next one,
+     *  so the read is still aligned, and is completed by it.
+     */
+    const usize page = usize(sysconf(_SC_PAGESIZE));
+    u32 state = scanner.dfa->start;
+    usize kept = 0;
+    usize kept_at = 0;
+
+    for (;;) {
+        const usize head = (kept + page - 1) / page * page;
+        if (!grow_scan_buffer(scanner, head + SCAN_BLOCK_BYTES))
+            return false;
+
+        u8* const begin = scanner.buffer + head - kept;
+        u8* const data = scanner.buffer + head;
+        memmove(begin, scanner.buffer + kept_at, kept);
+        kept_at = head - kept;
+
+        const ssize_t n = read(fd, data, scanner.buffer_size - head);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return false;
+        if (n == 0)
+            break;
+
+        const usize nread = usize(n);
+        const u8* const end = data + nread;
+        /* A match may start in an earlier block, so the offsets are not prefiltered here */
+        if (scanner.offsets) {
+            state = scan_offsets(scanner, state, data, end);
+            scanner.num_bytes += nread;
+            continue;
+        }
+
+        /* The kept bytes have no newline, so the block ends the lines if the new bytes do */
+        const auto* newline = static_cast<const u8*>(memrchr(data, '\n', nread));
+        const u8* const last_line = newline ? newline + 1 : begin;
+        if (newline) {
+            scan_lines(scanner, begin, last_line);
+            scanner.num_bytes += usize(last_line - begin);
+        }
+        kept = usize(end - last_line);
+        kept_at = usize(last_line - scanner.buffer);
+    }
+
+    if (kept)
+        scan_block(scanner, scanner.buffer + kept_at, scanner.buffer + kept_at + kept);
+
+    return true;
+}
+
+bool
+scan_file(Scanner& scanner, const int fd)
+{
+    /*
+     *  Map the regular files, unless they are read from an offset such as a
+     *  redirected standard input that was partly consumed. Pipes, terminals
+     *  and the files that cannot be mapped are read.
+     */
+    struct stat st;
+    const bool mappable = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+                          lseek(fd, 0, SEEK_CUR) == 0;
+    if (mappable && scan_mapped(scanner, fd, usize(st.st_size)))
+        return true;
+
+    return scan_stream(scanner, fd);
+}
+
+void
+free_scan_buffer(Scanner& scanner)
+{
+    if (scanner.buffer)
+        munmap(scanner.buffer, scanner.buffer_size);
+    scanner.buffer = nullptr;
+    scanner.buffer_size = 0;
+}
+
+void
+get_symbol_ranges(const Graph& g, const usize src, std::vector<SymbolRange>& ranges)
+{
+    /* Merge the consecutive bytes that lead to the same state */
+    std::array<u32, NUM_CHARS> dest_of;
+    dest_of.fill(UNKNOWN_STATE);
+    for (auto [dest, symbol] : edges(g, src))
+        dest_of[u8(symbol)] = dest;
+
+    ranges.clear();
+    for (usize c = 0; c < NUM_CHARS; ++c) {
+        if (dest_of[c] == UNKNOWN_STATE)
+            continue;
+
+        auto* last = ranges.empty() ? nullptr : &ranges.back();
+        if (last && usize(last->hi) + 1 == c && last->dest == dest_of[c])
+            last->hi = u8(c);
+        else
+            ranges.push_back({u8(c), u8(c), dest_of[c]});
+    }
+}
+
+usize
+add_label(JitCode& jit)
+{
+    jit.labels.push_back(EMPTY_SLOT);
+    return jit.labels.size() - 1;
+}
+
+void
+emit(JitCode& jit, const std::initializer_list<u8> bytes)
+{
+    jit.bytes.insert(jit.bytes.end(), bytes);
+}
+
 void
-add_transitive_closure(Graph& g)
+emit_u32(JitCode& jit, const u32 value)
 {
-    auto& [adj, flags, _] = g;
-
-    std::vector<Transition> to_add;
-    for (usize src = 0; src < adj.size(); ++src) {
-        for (auto& f : flags)
-            f &= ~VISITED;
-        add_transitive_closure_helper(src, src, to_add, g);
-
-        adj[src].insert(adj[src].end(), to_add.begin(), to_add.end());
-        to_add.clear();
-    }
+    for (usize i = 0; i < sizeof(value); ++i)
+        jit.bytes.push_back(u8(value >> (8 * i)));
 }
 
 void
-remove_lambdas(Graph& g)
+emit_jump(JitCode& jit, const std::initializer_list<u8> opcode, const usize label)
 {
-    auto& adj = g.adj;
-
-    for (usize u = 0; u < adj.size(); ++u) {
-        std::vector<Transition> to_add;
-        for (auto [v, to_v] : adj[u]) {
-            if (to_v != S_LAMBDA)
-                continue;
+    emit(jit, opcode);
+    jit.jumps.emplace_back(jit.bytes.size(), label);
+    emit_u32(jit, 0);
+}
 
-            for (auto [w, to_w] : adj[v]) {
-                if (to_w != S_LAMBDA)
-                    to_add.emplace_back(w, to_w);
-            }
-        }
+void
+emit_ranges(JitCode& jit, const std::span<const SymbolRange> ranges, const usize reject)
+{
+    /* Split long lists of ranges in halves, as the C output does */
+    if (ranges.size() > 4) {
+        const auto half = ranges.size() / 2;
+        const usize upper = add_label(jit);
 
-        adj[u].insert(adj[u].end(), to_add.begin(), to_add.end());
+        emit(jit, {0x3c, ranges[half].lo});       /* cmp al, lo */
+        emit_jump(jit, {0x0f, 0x83}, upper);      /* jae upper */
+        emit_ranges(jit, ranges.first(half), reject);
+        jit.labels[upper] = jit.bytes.size();
+        emit_ranges(jit, ranges.subspan(half), reject);
+        return;
     }
 
-    for (auto& ts : adj) {
-        auto lambdas = ranges::partition(ts, [](auto& t) { return t.symbol != S_LAMBDA; });
-        ts.erase(lambdas.begin(), lambdas.end());
-
-        ranges::sort(ts);
-        auto duplicates = ranges::unique(ts);
-        ts.erase(duplicates.begin(), duplicates.end());
+    for (auto [lo, hi, dest] : ranges) {
+        if (lo == hi) {
+            emit(jit, {0x3c, lo});                /* cmp al, lo */
+            emit_jump(jit, {0x0f, 0x84}, dest);   /* je dest */
+        } else {
+            /* One unsigned compare tests both bounds */
+            emit(jit, {0x8d, 0x88});              /* lea ecx, [rax - lo] */
+            emit_u32(jit, -u32(lo));
+            emit(jit, {0x81, 0xf9});              /* cmp ecx, hi - lo */
+            emit_u32(jit, u32(hi - lo));
+            emit_jump(jit, {0x0f, 0x86}, dest);   /* jbe dest */
+        }
     }
+    emit_jump(jit, {0xe9}, reject);               /* jmp reject */
 }
 
-Graph
-to_dfa_graph(const Graph& nfa)
+std::optional<JitDFA>
+jit_compile_dfa(const Graph& g)
 {
-    Graph dfa{};
-
-    if (nfa.adj.empty())
-        return dfa;
+    /*
+     *  Translate the DFA into x86-64 code, called as entry(begin, end) with
+     *  the System V calling convention (rdi = begin, rsi = end). Each state
+     *  is a label that ends the match at the end of the input, or loads the
+     *  next byte and jumps to the next state through a chain of compares.
+     */
+#if defined(__x86_64__)
+    const usize size = num_states(g);
 
-    std::queue<std::vector<usize>> queue;
-    std::unordered_map<std::vector<usize>, usize> ids;
+    JitCode jit{};
+    jit.labels.assign(size, EMPTY_SLOT);
+    const usize reject = add_label(jit);
+    const usize accept = add_label(jit);
 
-    queue.push({nfa.start});
-    ids.insert({{nfa.start}, 0});
-    dfa.adj.emplace_back();
-    dfa.flags.emplace_back();
-    dfa.flags[0] |= START;
-    dfa.start = 0;
-
-    while (!queue.empty()) {
-        auto src_subset = std::move(queue.front());
-        queue.pop();
+    std::vector<SymbolRange> ranges;
+    for (usize src = 0; src < size; ++src) {
+        jit.labels[src] = jit.bytes.size();
+        emit(jit, {0x48, 0x39, 0xf7});                          /* cmp rdi, rsi */
+        emit_jump(jit, {0x0f, 0x84}, g.flags[src] & FINAL ? accept : reject); /* je */
+        emit(jit, {0x0f, 0xb6, 0x07});                          /* movzx eax, byte [rdi] */
+        emit(jit, {0x48, 0xff, 0xc7});                          /* inc rdi */
 
-        auto src_subset_id = ids.at(src_subset);
+        get_symbol_ranges(g, src, ranges);
+        emit_ranges(jit, ranges, reject);
+    }
 
-        /* Check if this subset will become a final node */
-        for (auto src : src_subset)
-            dfa.flags[src_subset_id] |= nfa.flags[src] & FINAL;
+    jit.labels[reject] = jit.bytes.size();
+    emit(jit, {0x31, 0xc0, 0xc3});                   /* xor eax, eax; ret */
+    jit.labels[accept] = jit.bytes.size();
+    emit(jit, {0xb8, 0x01, 0x00, 0x00, 0x00, 0xc3}); /* mov eax, 1; ret */
 
-        /* Create edges from the source subset through each symbol */
-        for (char target_symbol : alphabet) {
-            std::unordered_set<usize> dest_subset;
-            for (auto src : src_subset) {
-                for (auto [dest, symbol] : nfa.adj[src]) {
-                    if (symbol == target_symbol)
-                        dest_subset.insert(dest);
-                }
-            }
+    for (auto [at, label] : jit.jumps) {
+        const u32 rel = u32(jit.labels[label] - (at + sizeof(u32)));
+        for (usize i = 0; i < sizeof(rel); ++i)
+            jit.bytes[at + i] = u8(rel >> (8 * i));
+    }
 
-            if (dest_subset.empty())
-                continue;
+    /* Write the code while the pages are writable, then make them executable only */
+    const usize page = usize(sysconf(_SC_PAGESIZE));
+    const usize mapped = (jit.bytes.size() + page - 1) / page * page;
+    void* code =
+        mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+        return std::nullopt;
 
-            auto dest_subset_id = dfa.adj.size();
-            auto dest_vec = std::vector(dest_subset.begin(), dest_subset.end());
-            auto [it, inserted] = ids.emplace(dest_vec, dest_subset_id);
+    std::copy(jit.bytes.begin(), jit.bytes.end(), static_cast<u8*>(code));
+    if (mprotect(code, mapped, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, mapped);
+        return std::nullopt;
+    }
 
-            /*
-             *  If this subset has not been visited yet, give it an identifier
-             *  and add it to the queue.
-             */
-            if (inserted) {
-                dfa.adj.emplace_back();
-                dfa.flags.emplace_back();
-                queue.push(std::move(dest_vec));
-            } else {
-                dest_subset_id = it->second;
-            }
+    const auto entry =
+        reinterpret_cast<JitMatchFn>(static_cast<u8*>(code) + jit.labels[g.start]);
+    return JitDFA{code, mapped, entry};
+#else
+    (void)g;
+    return std::nullopt;
+#endif
+}
 
-            /* Create the edge from the source subset to the destination */
-            dfa.adj[src_subset_id].emplace_back(dest_subset_id, target_symbol);
-        }
-    }
+bool
+match_jit_dfa(const JitDFA& jit, const std::string_view input)
+{
+    const auto begin = reinterpret_cast<const u8*>(input.data());
+    return jit.entry(begin, begin + input.size()) != 0;
+}
 
-    return dfa;
+void
+free_jit_dfa(JitDFA& jit)
+{
+    munmap(jit.code, jit.size);
+    jit = {};
 }
 
 void
 print_components(const Graph& g, FILE* output)
 {
-    auto& [adj, flags, start] = g;
+    auto& flags = g.flags;
 
-    auto size = adj.size();
+    auto size = num_states(g);
 
     /* Print states */
     fprintf(output, "STATES = {");
@@ -452,11 +3375,7 @@ print_components(const Graph& g, FILE* output)
     fprintf(output, "}\n");
 
     /* Print alphabet */
-    std::set<char> min_alphabet;
-    for (usize src = 0; src < size; ++src) {
-        for (auto& [_, symbol] : adj[src])
-            min_alphabet.insert(symbol);
-    }
+    std::set<char> min_alphabet(g.symbols.begin(), g.symbols.end());
 
     fprintf(output, "SIGMA = {");
     first = true;
@@ -469,8 +3388,8 @@ print_components(const Graph& g, FILE* output)
     /* Print transitions */
     fprintf(output, "TRANSITIONS:\n");
     for (usize src = 0; src < size; ++src) {
-        for (auto [dest, symbol] : adj[src])
-            fprintf(output, "\tδ(q%lu, %c) = q%lu\n", src, symbol, dest);
+        for (auto [dest, symbol] : edges(g, src))
+            fprintf(output, "\tδ(q%lu, %c) = q%u\n", src, symbol, dest);
     }
 
     /* Print start state */
@@ -486,6 +3405,102 @@ print_components(const Graph& g, FILE* output)
         }
     }
     fprintf(output, "}\n");
+
+    /* Print the regexes accepted by the final states of a union, numbered from 1 */
+    if (g.pattern_offsets.empty())
+        return;
+
+    fprintf(output, "ACCEPTED REGEXES:\n");
+    for (usize src = 0; src < size; ++src) {
+        const auto patterns = accepted_patterns(g, src);
+        if (patterns.empty())
+            continue;
+
+        fprintf(output, "\tq%lu: {", src);
+        for (usize i = 0; i < patterns.size(); ++i)
+            fprintf(output, i ? ", %u" : "%u", patterns[i] + 1);
+        fprintf(output, "}\n");
+    }
+}
+
+void
+print_symbol(const u8 c, FILE* output)
+{
+    if (std::isalnum(c))
+        fprintf(output, "'%c'", c);
+    else
+        fprintf(output, "%u", c);
+}
+
+void
+print_ranges(const std::span<const SymbolRange> ranges, const usize indent, FILE* output)
+{
+    /* Split long lists of ranges in halves, so that a state needs few compares */
+    if (ranges.size() > 4) {
+        const auto half = ranges.size() / 2;
+
+        fprintf(output, "%*sif (c < ", int(indent), "");
+        print_symbol(ranges[half].lo, output);
+        fprintf(output, ") {\n");
+        print_ranges(ranges.first(half), indent + 4, output);
+        fprintf(output, "%*sreturn 0;\n%*s}\n", int(indent + 4), "", int(indent), "");
+        print_ranges(ranges.subspan(half), indent, output);
+        return;
+    }
+
+    for (auto [lo, hi, dest] : ranges) {
+        fprintf(output, "%*sif (", int(indent), "");
+        if (lo == hi) {
+            fprintf(output, "c == ");
+            print_symbol(lo, output);
+        } else {
+            /* One unsigned compare tests both bounds */
+            fprintf(output, "(unsigned)(c - ");
+            print_symbol(lo, output);
+            fprintf(output, ") <= %uu", hi - lo);
+        }
+        fprintf(output, ")\n%*sgoto q%u;\n", int(indent + 4), "", dest);
+    }
+}
+
+void
+print_c_source(const Graph& g, FILE* output, const std::string_view regex, const char* name)
+{
+    /*
+     *  Emit a direct-coded matcher: every state is a labeled block that
+     *  compares the next byte against the ranges of bytes of its edges and
+     *  jumps to the destination, as re2c does.
+     */
+    fprintf(output,
+            "/* Generated by rtd from the regex '%.*s' */\n"
+            "#include <stddef.h>\n\n"
+            "int\n"
+            "%s(const char* input, size_t length)\n"
+            "{\n"
+            "    const unsigned char* p = (const unsigned char*)input;\n"
+            "    const unsigned char* end = p + length;\n"
+            "    unsigned char c;\n",
+            int(regex.size()),
+            regex.data(),
+            name);
+    fprintf(output, "\n    goto q%zu;\n", g.start);
+
+    std::vector<SymbolRange> ranges;
+    for (usize src = 0; src < num_states(g); ++src) {
+        fprintf(output,
+                "\nq%zu:\n"
+                "    if (p == end)\n"
+                "        return %d;\n"
+                "    c = *p++;\n",
+                src,
+                g.flags[src] & FINAL ? 1 : 0);
+
+        get_symbol_ranges(g, src, ranges);
+        print_ranges(ranges, 4, output);
+        fprintf(output, "    return 0;\n");
+    }
+
+    fprintf(output, "}\n");
 }
 
 void
@@ -506,8 +3521,12 @@ set_attrs(void* obj, const AgobjAttrs& attrs)
 void
 export_graph(const Graph& g, FILE* output, const std::string_view infix)
 {
-    const auto& [adj, flags, _] = g;
-    const usize size = adj.size();
+    const auto& flags = g.flags;
+    const usize size = num_states(g);
+
+    /* Graphviz keeps global state, so the graphs of a batch are exported one at a time */
+    static std::mutex graphviz_lock;
+    std::scoped_lock guard(graphviz_lock);
 
     Agraph_t* graph = agopen((char*)"g", Agdirected, 0);
     assert(graph);
@@ -542,7 +3561,7 @@ export_graph(const Graph& g, FILE* output, const std::string_view infix)
     }
 
     for (usize src = 0; src < size; ++src) {
-        for (auto [dest, symbol] : adj[src]) {
+        for (auto [dest, symbol] : edges(g, src)) {
             lb = {symbol};
             if (lb[0] == S_LAMBDA)
                 lb = LAMBDA_UTF;
@@ -570,47 +3589,540 @@ usage()
         stderr,
         "%s\n",
         "USAGE:\n"
-        "    rtd [FLAGS/OPTIONS] <regex>\n\n"
+        "    rtd [FLAGS/OPTIONS] <regex>\n"
+        "    rtd -d <dfa_file> -x <input>\n"
+        "    rtd -b <regex_file> [FLAGS/OPTIONS]\n"
+        "    rtd -u [FLAGS/OPTIONS] <regex>...\n"
+        "    rtd match [FLAGS/OPTIONS] <regex> [<file>...]\n\n"
         "FLAGS:\n"
         "    -h\n"
         "        Print help info.\n"
         "    -a\n"
         "        Set the alphabet of the regex as all alphanumericals.\n"
         "    -e\n"
-        "        Export the graph in DOT language (by default, only the DFA components will be printed)\n\n"
+        "        Export the graph in DOT language (same as -f dot).\n"
+        "    -m\n"
+        "        Minimize the DFA using Hopcroft's algorithm.\n"
+        "    -l\n"
+        "        Match the input given with -x using a lazily built DFA with a bounded\n"
+        "        cache.\n"
+        "    -u\n"
+        "        Combine the regexes (the arguments, or the lines of -b) into one DFA whose\n"
+        "        final states report which of the regexes (numbered from 1) they accept.\n"
+        "    -p\n"
+        "        With match, print the offset after each match instead of the matching\n"
+        "        lines.\n"
+        "    -J\n"
+        "        Match the input given with -x using the DFA compiled to x86-64 machine\n"
+        "        code.\n\n"
         "OPTIONS:\n"
+        "    -f <format>\n"
+        "        Set the output format: 'text' (DFA components, default), 'dot', 'c'\n"
+        "        (matcher source) or 'bin' (DFA tables to load with -d).\n"
+        "    -c <construction>\n"
+        "        Set the construction algorithm: 'thompson' (default), 'glushkov' or\n"
+        "        'derivative'.\n"
+        "    -j <threads>\n"
+        "        Set the number of threads used by the powerset construction, by a batch, or\n"
+        "        by the scan of a mapped file (default is 1).\n"
         "    -s <alphabet>\n"
         "        Set the alphabet of the regex (only alphanumericals allowed).\n"
         "    -o <output_file>\n"
-        "        Set the path at which the graph file will be written (default is stdout).");
+        "        Set the path at which the graph file will be written (default is stdout).\n"
+        "    -x <input>\n"
+        "        Match the input against the regex instead of printing the DFA.\n"
+        "    -b <regex_file>\n"
+        "        Compile the regexes of the file (one per line, '-' for stdin) with the\n"
+        "        workers set by -j, and write their results in the order of the file.\n"
+        "    -C <cache_dir>\n"
+        "        Store the DFA in the directory, keyed by the regex and the options, and\n"
+        "        load it from there instead of compiling the regex when it is already\n"
+        "        stored.\n"
+        "    -d <dfa_file>\n"
+        "        Match the input given with -x using the DFA written by -f bin, instead of a\n"
+        "        regex.");
     /* clang-format on */
 }
 
+std::optional<Graph>
+compile_regex(const Context& ctx,
+              const std::string_view regex,
+              FILE* errors,
+              std::string* literal)
+{
+    /* The AST and the construction scratch live in one arena, released as a whole */
+    std::pmr::monotonic_buffer_resource arena(16 * (regex.size() + 1) * sizeof(Edge));
+    Parser parser{.regex = regex,
+                  .alphabet = ctx.alphabet,
+                  .nodes = std::pmr::vector<RegexNode>(&arena)};
+    if (!rtd::parse_regex(parser)) {
+        fprintf(errors,
+                "Regex '%.*s' is invalid at position %zu: %s\n",
+                int(regex.size()),
+                regex.data(),
+                parser.pos,
+                parser.error);
+        return std::nullopt;
+    }
+
+    const auto simplified = simplify_regex(parser.nodes, &arena);
+    const std::span<const RegexNode> ast = simplified;
+#ifdef RTD_DEBUG
+    fprintf(stderr,
+            "Regex: %.*s\nAST: %zu nodes, %zu after simplification\n",
+            int(regex.size()),
+            regex.data(),
+            parser.nodes.size(),
+            ast.size());
+#endif
+    if (literal)
+        *literal = get_required_literal(ast);
+
+    if (ctx.construction == Construction::DERIVATIVE)
+        return get_derivative_dfa_graph(ast, ctx.alphabet);
+    if (ctx.construction == Construction::GLUSHKOV)
+        return get_glushkov_graph(ast, &arena);
+
+    /* Transform λ-NFA to NFA without λ-transitions (Glushkov's NFA has none) */
+    auto nfa_graph = get_nfa_graph(ast, &arena);
+    add_transitive_closure(nfa_graph);
+    remove_lambdas(nfa_graph);
+
+    return nfa_graph;
+}
+
+int
+write_dfa(const Context& ctx,
+          const Graph& dfa,
+          const std::string_view regex,
+          const char* name,
+          FILE* output,
+          FILE* errors)
+{
+    switch (ctx.format) {
+    case OutputFormat::TEXT:
+        print_components(dfa, output);
+        break;
+    case OutputFormat::DOT:
+        export_graph(dfa, output, "\n\n" + std::string(regex));
+        break;
+    case OutputFormat::C:
+        print_c_source(dfa, output, regex, name);
+        break;
+    case OutputFormat::BIN:
+        if (!write_dfa_file(make_dense_dfa(dfa), {}, output)) {
+            fprintf(errors, "Failed to write the DFA file: %s\n", strerror(errno));
+            return EXIT_FAILURE;
+        }
+        break;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int
+run_regex(const Context& ctx,
+          const std::string_view regex,
+          const char* name,
+          FILE* output,
+          FILE* errors)
+{
+    std::optional<Graph> nfa_graph;
+    std::optional<Graph> dfa_graph;
+
+    /*
+     *  A cached DFA replaces the whole pipeline. Its tables are matched in
+     *  place, and turned back into a graph for the other outputs.
+     */
+    std::string cache_key;
+    std::string cache_path;
+    std::optional<MappedDFA> cached;
+    if (ctx.cache_dir && !ctx.lazy) {
+        cache_key = get_cache_key(ctx, regex);
+        cache_path = get_cache_path(ctx, cache_key);
+        const char* error = nullptr;
+        cached = map_dfa_file(cache_path.c_str(), error);
+    }
+
+    /* An entry whose key differs is another regex whose key has the same hash, a miss */
+    if (cached && cached->key != cache_key) {
+        unmap_dfa_file(*cached);
+        cached.reset();
+    }
+    if (cached && (!ctx.input || ctx.jit)) {
+        dfa_graph = get_dense_dfa_graph(cached->dfa);
+        unmap_dfa_file(*cached);
+    }
+
+    if (!cached) {
+        auto graph = compile_regex(ctx, regex, errors, nullptr);
+        if (!graph)
+            return EXIT_FAILURE;
+
+        if (ctx.construction == Construction::DERIVATIVE)
+            dfa_graph = std::move(graph);
+        else
+            nfa_graph = std::move(graph);
+    }
+
+    if (nfa_graph && !ctx.lazy) {
+        dfa_graph = ctx.num_threads > 1 ? to_dfa_graph_parallel(*nfa_graph, ctx.num_threads)
+                                        : to_dfa_graph(*nfa_graph);
+    }
+
+    if (ctx.minimize && dfa_graph && !cached)
+        dfa_graph = minimize_dfa_graph(*dfa_graph);
+
+    /* A failure to cache the DFA is not an error, the next run will try again */
+    if (!cache_path.empty() && !cached) {
+        const auto dense_dfa = make_dense_dfa(*dfa_graph);
+        if (!store_cached_dfa(ctx.cache_dir, cache_path, cache_key, dense_dfa))
+            fprintf(errors, "Failed to cache the DFA at '%s'\n", cache_path.c_str());
+    }
+
+    if (ctx.input) {
+        bool matched;
+        if (ctx.lazy) {
+            LazyDFA lazy_dfa{.nfa = &*nfa_graph,
+                             .budget = LAZY_CACHE_BYTES,
+                             .classes = get_symbol_classes(*nfa_graph)};
+            matched = match_lazy_dfa(lazy_dfa, *ctx.input);
+#ifdef RTD_DEBUG
+            fprintf(stderr,
+                    "Lazy DFA: %zu cached states, %zu flushes\n",
+                    lazy_dfa.flags.size(),
+                    lazy_dfa.num_flushes);
+#endif
+        } else if (ctx.jit) {
+            auto jit_dfa = jit_compile_dfa(*dfa_graph);
+            if (!jit_dfa) {
+                fprintf(errors, "Failed to compile the DFA to x86-64 machine code\n");
+                return EXIT_FAILURE;
+            }
+            matched = match_jit_dfa(*jit_dfa, *ctx.input);
+            free_jit_dfa(*jit_dfa);
+        } else if (cached) {
+            matched = match_dense_dfa(cached->dfa, *ctx.input);
+            unmap_dfa_file(*cached);
+        } else {
+            matched = match_dense_dfa(view_dense_dfa(make_dense_dfa(*dfa_graph)), *ctx.input);
+        }
+
+        fprintf(output, matched ? "MATCH\n" : "NO MATCH\n");
+        return matched ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    return write_dfa(ctx, *dfa_graph, regex, name, output, errors);
+}
+
+int
+run_union(const Context& ctx,
+          const std::span<const std::string> regexes,
+          FILE* output,
+          FILE* errors)
+{
+    /* The λ-free NFAs of the regexes share a new start state, their final states keep IDs */
+    std::vector<Graph> nfa_graphs;
+    for (const auto& regex : regexes) {
+        auto nfa_graph = compile_regex(ctx, regex, errors, nullptr);
+        if (!nfa_graph)
+            return EXIT_FAILURE;
+        nfa_graphs.push_back(std::move(*nfa_graph));
+    }
+    const auto nfa_graph = merge_nfa_graphs(nfa_graphs);
+    nfa_graphs.clear();
+
+    auto dfa_graph = ctx.num_threads > 1 ? to_dfa_graph_parallel(nfa_graph, ctx.num_threads)
+                                         : to_dfa_graph(nfa_graph);
+    if (ctx.minimize)
+        dfa_graph = minimize_dfa_graph(dfa_graph);
+
+    /* Report the regexes (numbered from 1) accepted by the state that ends the input */
+    if (ctx.input) {
+        const auto dfa = make_dense_dfa(dfa_graph);
+        const u32 last = run_dense_dfa(view_dense_dfa(dfa), *ctx.input);
+        const usize state = last / dfa.classes.num_classes;
+        const usize begin = dfa.pattern_offsets[state];
+        const auto patterns =
+            std::span(dfa.patterns).subspan(begin, dfa.pattern_offsets[state + 1] - begin);
+        if (patterns.empty()) {
+            fprintf(output, "NO MATCH\n");
+            return EXIT_FAILURE;
+        }
+
+        fprintf(output, "MATCH {");
+        for (usize i = 0; i < patterns.size(); ++i)
+            fprintf(output, i ? ", %u" : "%u", patterns[i] + 1);
+        fprintf(output, "}\n");
+        return EXIT_SUCCESS;
+    }
+
+    std::string label;
+    for (const auto& regex : regexes)
+        label += (label.empty() ? "" : " | ") + regex;
+
+    return write_dfa(ctx, dfa_graph, label, "rtd_match", output, errors);
+}
+
+int
+run_scan(const Context& ctx,
+         const std::string_view regex,
+         const std::span<char* const> paths,
+         const bool offsets,
+         FILE* output)
+{
+    Prefilter filter{};
+    auto nfa_graph = compile_regex(ctx, regex, stderr, &filter.literal);
+    if (!nfa_graph)
+        return EXIT_FAILURE;
+
+    /* A DFA is also an NFA, so the derivative construction is searched the same way */
+    const auto search_graph = get_search_nfa_graph(*nfa_graph);
+    auto dfa_graph = ctx.num_threads > 1 ? to_dfa_graph_parallel(search_graph, ctx.num_threads)
+                                         : to_dfa_graph(search_graph);
+    if (ctx.minimize)
+        dfa_graph = minimize_dfa_graph(dfa_graph);
+    const auto dfa = make_scan_dfa(dfa_graph);
+
+    /* Lines bound the matches around an occurrence, so only the offsets need a reverse DFA */
+    if (offsets && !filter.literal.empty())
+        filter.reverse = make_scan_dfa(to_dfa_graph(get_reverse_prefix_graph(*nfa_graph)));
+#ifdef RTD_DEBUG
+    fprintf(stderr, "Required literal: '%s'\n", filter.literal.c_str());
+#endif
+
+    Scanner scanner{.dfa = &dfa,
+                    .filter = filter.literal.empty() ? nullptr : &filter,
+                    .offsets = offsets,
+                    .output = output,
+                    .name = nullptr,
+                    .num_threads = ctx.num_threads};
+    usize total_bytes = 0;
+    bool failed = false;
+    const auto begin_time = std::chrono::steady_clock::now();
+
+    /* Without paths the standard input is scanned, as it is for '-' */
+    std::vector<const char*> inputs(paths.begin(), paths.end());
+    if (inputs.empty())
+        inputs.push_back("-");
+
+    for (const char* path : inputs) {
+        const bool from_stdin = std::string_view(path) == "-";
+        const int fd = from_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Failed to open '%s': %s\n", path, strerror(errno));
+            failed = true;
+            continue;
+        }
+
+        scanner.name = inputs.size() > 1 ? path : nullptr;
+        if (!scan_file(scanner, fd)) {
+            fprintf(stderr, "Failed to read '%s': %s\n", path, strerror(errno));
+            failed = true;
+        }
+        total_bytes += std::exchange(scanner.num_bytes, 0);
+
+        if (!from_stdin)
+            close(fd);
+    }
+    free_scan_buffer(scanner);
+
+    const auto end_time = std::chrono::steady_clock::now();
+    const std::chrono::duration<double> elapsed = end_time - begin_time;
+    fprintf(stderr,
+            "Scanned %zu bytes in %.3f s (%.2f GB/s)\n",
+            total_bytes,
+            elapsed.count(),
+            double(total_bytes) / elapsed.count() / 1e9);
+
+    return !failed && scanner.num_matches ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+std::vector<std::string>
+read_regexes(FILE* input)
+{
+    /* One regex per line */
+    std::vector<std::string> regexes;
+    char* line = nullptr;
+    usize capacity = 0;
+    for (ssize_t length; (length = getline(&line, &capacity, input)) != -1;) {
+        if (length > 0 && line[length - 1] == '\n')
+            --length;
+        regexes.emplace_back(line, usize(length));
+    }
+    free(line);
+
+    return regexes;
+}
+
+int
+run_batch(const Context& ctx, const std::span<const std::string> regexes, FILE* output)
+{
+    /* The workers split the regexes, so each one is compiled by a single thread */
+    Context job_ctx = ctx;
+    job_ctx.num_threads = 1;
+
+    std::vector<BatchResult> results(regexes.size());
+    std::atomic<usize> next = 0;
+    std::mutex lock;
+    std::condition_variable finished;
+
+    auto work = [&]() {
+        for (usize i; (i = next.fetch_add(1, std::memory_order_relaxed)) < regexes.size();) {
+            char* out_data = nullptr;
+            char* err_data = nullptr;
+            usize out_size = 0;
+            usize err_size = 0;
+            FILE* out = open_memstream(&out_data, &out_size);
+            FILE* err = open_memstream(&err_data, &err_size);
+
+            BatchResult result{};
+            if (out && err) {
+                const auto name = "rtd_match_" + std::to_string(i + 1);
+                result.status = run_regex(job_ctx, regexes[i], name.c_str(), out, err);
+            } else {
+                result.errors = "Failed to buffer the output of a regex\n";
+                result.status = EXIT_FAILURE;
+            }
+            if (out && fclose(out) == 0)
+                result.output.assign(out_data, out_size);
+            if (err && fclose(err) == 0)
+                result.errors.assign(err_data, err_size);
+            free(out_data);
+            free(err_data);
+
+            {
+                std::scoped_lock guard(lock);
+                results[i] = std::move(result);
+                results[i].done = true;
+            }
+            finished.notify_one();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (usize worker = 0; worker < std::min(ctx.num_threads, regexes.size()); ++worker)
+        threads.emplace_back(work);
+
+    /* Write the results in the order of the regexes, as soon as they are ready */
+    int status = EXIT_SUCCESS;
+    for (auto& result : results) {
+        std::unique_lock guard(lock);
+        finished.wait(guard, [&] { return result.done; });
+        const auto done = std::move(result);
+        guard.unlock();
+
+        fwrite(done.errors.data(), 1, done.errors.size(), stderr);
+        fwrite(done.output.data(), 1, done.output.size(), output);
+        if (done.status != EXIT_SUCCESS)
+            status = EXIT_FAILURE;
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    return status;
+}
+
 int
-main(const int argc, char* argv[])
+main(int argc, char* argv[])
 {
+    /* The match subcommand scans files, its options follow it */
+    const bool scan = argc > 1 && std::string_view(argv[1]) == "match";
+    if (scan) {
+        --argc;
+        ++argv;
+    }
+
     const char* output_path = nullptr;
+    const char* dfa_path = nullptr;
+    const char* batch_path = nullptr;
     bool all_alnum = false;
-    bool exp = false;
+    bool combine = false;
+    bool offsets = false;
+    Context ctx{};
 
     int opt;
-    while ((opt = getopt(argc, argv, "heas:o:")) != -1) {
+    while ((opt = getopt(argc, argv, "heamluJpc:f:j:s:o:x:d:C:b:")) != -1) {
         switch (opt) {
         case 'h':
             usage();
             return EXIT_FAILURE;
         case 'e':
-            exp = true;
+            ctx.format = OutputFormat::DOT;
             break;
         case 'a':
             all_alnum = true;
             break;
+        case 'm':
+            ctx.minimize = true;
+            break;
+        case 'l':
+            ctx.lazy = true;
+            break;
+        case 'u':
+            combine = true;
+            break;
+        case 'p':
+            offsets = true;
+            break;
+        case 'J':
+            ctx.jit = true;
+            break;
+        case 'x':
+            ctx.input = optarg;
+            break;
+        case 'c':
+            if (std::string_view(optarg) == "thompson") {
+                ctx.construction = Construction::THOMPSON;
+            } else if (std::string_view(optarg) == "glushkov") {
+                ctx.construction = Construction::GLUSHKOV;
+            } else if (std::string_view(optarg) == "derivative") {
+                ctx.construction = Construction::DERIVATIVE;
+            } else {
+                fprintf(stderr, "Unknown construction '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'f':
+            if (std::string_view(optarg) == "text") {
+                ctx.format = OutputFormat::TEXT;
+            } else if (std::string_view(optarg) == "dot") {
+                ctx.format = OutputFormat::DOT;
+            } else if (std::string_view(optarg) == "c") {
+                ctx.format = OutputFormat::C;
+            } else if (std::string_view(optarg) == "bin") {
+                ctx.format = OutputFormat::BIN;
+            } else {
+                fprintf(stderr, "Unknown output format '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'j': {
+            const std::string_view arg = optarg;
+            auto& num_threads = ctx.num_threads;
+            auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), num_threads);
+            if (ec != std::errc() || end != arg.data() + arg.size() || num_threads == 0) {
+                fprintf(stderr, "The number of threads must be a positive integer\n");
+                return EXIT_FAILURE;
+            }
+            break;
+        }
         case 's':
-            alphabet = optarg;
+            ctx.alphabet = optarg;
             break;
         case 'o':
             output_path = optarg;
             break;
+        case 'd':
+            dfa_path = optarg;
+            break;
+        case 'C':
+            ctx.cache_dir = optarg;
+            break;
+        case 'b':
+            batch_path = optarg;
+            break;
         default:
             usage();
             return EXIT_FAILURE;
@@ -618,19 +4130,64 @@ main(const int argc, char* argv[])
     }
 
     if (all_alnum)
-        alphabet = ALL_ALPHANUMS;
-    if (alphabet.empty()) {
+        ctx.alphabet = ALL_ALPHANUMS;
+    if (ctx.alphabet.empty()) {
         fprintf(stderr, "The alphabet can not be empty\n");
         return EXIT_FAILURE;
     }
 
-    if (optind >= argc) {
+    if (ctx.lazy && !ctx.input) {
+        fprintf(stderr, "Lazy matching requires an input (-x)\n");
+        return EXIT_FAILURE;
+    }
+    if (ctx.jit && (!ctx.input || ctx.lazy)) {
+        fprintf(stderr, "JIT matching requires an input (-x) and excludes lazy matching\n");
+        return EXIT_FAILURE;
+    }
+    if (ctx.lazy && ctx.construction == Construction::DERIVATIVE) {
+        fprintf(stderr, "Lazy matching requires the 'thompson' or 'glushkov' construction\n");
+        return EXIT_FAILURE;
+    }
+    if (combine && ctx.construction == Construction::DERIVATIVE) {
+        fprintf(stderr, "A union (-u) requires the 'thompson' or 'glushkov' construction\n");
+        return EXIT_FAILURE;
+    }
+    if (combine && (ctx.lazy || ctx.jit || ctx.cache_dir || ctx.format == OutputFormat::BIN)) {
+        fprintf(stderr, "A union (-u) excludes -l, -J, -C and the 'bin' format\n");
+        return EXIT_FAILURE;
+    }
+
+    const bool other_mode = ctx.input || ctx.lazy || ctx.jit || ctx.cache_dir || dfa_path ||
+                            batch_path || combine || ctx.format != OutputFormat::TEXT;
+    if (scan && other_mode) {
+        fprintf(stderr, "rtd match only takes the -a, -m, -p, -c, -j, -s and -o options\n");
+        return EXIT_FAILURE;
+    }
+    if (offsets && !scan) {
+        fprintf(stderr, "Reporting offsets (-p) requires the match subcommand\n");
+        return EXIT_FAILURE;
+    }
+
+    if (dfa_path && (!ctx.input || ctx.lazy || ctx.jit || batch_path)) {
+        fprintf(stderr, "A DFA file (-d) requires an input (-x) and the dense matcher\n");
+        return EXIT_FAILURE;
+    }
+
+    if (batch_path && optind < argc) {
+        fprintf(stderr, "A batch (-b) reads its regexes from a file, not from <regex>\n");
+        return EXIT_FAILURE;
+    }
+    if (batch_path && ctx.format == OutputFormat::BIN && !ctx.input) {
+        fprintf(stderr, "A batch (-b) can not be written in the 'bin' format, see -C\n");
+        return EXIT_FAILURE;
+    }
+    if (!batch_path && !dfa_path && optind >= argc) {
         fprintf(stderr, "Missing <regex> argument\n\n");
         usage();
         return EXIT_FAILURE;
     }
 
-    for (char c : alphabet) {
+    for (char c : ctx.alphabet) {
         if (!std::isalnum(c)) {
             fprintf(stderr, "The alphabet can only contain alphanumericals\n");
             return EXIT_FAILURE;
@@ -638,47 +4195,51 @@ main(const int argc, char* argv[])
     }
 
     /* Remove duplicates from alphabet input */
-    auto set = std::set<char>(alphabet.begin(), alphabet.end());
-    alphabet = std::string(set.begin(), set.end());
-
-    const std::string_view infix = argv[optind];
-    const auto with_concat_op = add_concatenation_op(infix);
-    const auto postfix = get_postfix(with_concat_op);
-    if (!postfix) {
-        fprintf(stderr, "Regex '%s' is invalid\n", infix.data());
-        usage();
+    auto set = std::set<char>(ctx.alphabet.begin(), ctx.alphabet.end());
+    ctx.alphabet = std::string(set.begin(), set.end());
+
+    auto output = output_path ? fopen(output_path, "w") : stdout;
+    if (!output) {
+        perror("fopen");
         return EXIT_FAILURE;
     }
 
-#ifdef RTD_DEBUG
-    fprintf(stderr,
-            "Infix: %s\nInfix with explicit concatenation operator: %s\nPostfix: %s\n",
-            infix.data(),
-            with_concat_op.data(),
-            postfix->data());
-#endif
+    /* A DFA file replaces the whole pipeline, the tables are used in place */
+    if (dfa_path) {
+        const char* error = nullptr;
+        auto mapped = map_dfa_file(dfa_path, error);
+        if (!mapped) {
+            fprintf(stderr, "Failed to load the DFA file '%s': %s\n", dfa_path, error);
+            return EXIT_FAILURE;
+        }
 
-    auto nfa_graph = get_nfa_graph(*postfix);
-    if (!nfa_graph) {
-        fprintf(stderr, "Failed to make NFA from regex\n");
-        usage();
-        return EXIT_FAILURE;
+        const bool matched = match_dense_dfa(mapped->dfa, *ctx.input);
+        unmap_dfa_file(*mapped);
+        fprintf(output, matched ? "MATCH\n" : "NO MATCH\n");
+        return matched ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    /* Transform λ-NFA to NFA without λ-transitions */
-    add_transitive_closure(*nfa_graph);
-    remove_lambdas(*nfa_graph);
+    if (scan)
+        return run_scan(ctx, argv[optind], {argv + optind + 1, argv + argc}, offsets, output);
 
-    auto dfa_graph = to_dfa_graph(*nfa_graph);
+    std::vector<std::string> regexes;
+    if (batch_path) {
+        const bool from_stdin = std::string_view(batch_path) == "-";
+        auto patterns = from_stdin ? stdin : fopen(batch_path, "r");
+        if (!patterns) {
+            perror("fopen");
+            return EXIT_FAILURE;
+        }
 
-    auto output = output_path ? fopen(output_path, "w") : stdout;
-    if (!output) {
-        perror("fopen");
-        return EXIT_FAILURE;
+        regexes = read_regexes(patterns);
+    } else {
+        regexes.assign(argv + optind, argv + argc);
     }
 
-    if (exp)
-        export_graph(dfa_graph, output, "\n\n" + std::string(infix));
-    else
-        print_components(dfa_graph, output);
+    if (combine)
+        return run_union(ctx, regexes, output, stderr);
+    if (batch_path)
+        return run_batch(ctx, regexes, output);
+
+    return run_regex(ctx, regexes[0], "rtd_match", output, stderr);
 }
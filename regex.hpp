@@ -0,0 +1,285 @@
+#ifndef RTD_REGEX_HPP
+#define RTD_REGEX_HPP
+
+#include <span>
+#include <string_view>
+#include <optional>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ *  Front end of rtd, shared with static_regex.hpp: the recursive descent
+ *  parser, which turns a regex into its AST, and Thompson's construction,
+ *  which turns the AST into the edges of a λ-NFA. Both are constexpr and
+ *  take their containers as template parameters, so that rtd keeps them in
+ *  the arena of a compilation and static_regex in std::vector during
+ *  constant evaluation.
+ */
+
+namespace rtd {
+
+/* Typedefs */
+/* clang-format off */
+using u8    = uint8_t;
+using u32   = uint32_t;
+using usize = size_t;
+
+/* Constants */
+inline constexpr char  S_LAMBDA    = '\0';
+inline constexpr char  OP_UNION    = '|';
+inline constexpr char  OP_KLEENE   = '*';
+inline constexpr char  OP_PLUS     = '+';
+inline constexpr char  OP_OPT      = '?';
+inline constexpr usize MAX_NESTING = 4096;
+
+/* Enums */
+enum class NodeKind : u8 {
+    SYMBOL = 0,
+    CONCAT,
+    UNION,
+    STAR,
+    PLUS,
+    OPT,
+};
+/* clang-format on */
+
+/* Structs */
+/* Unary nodes only use their left child */
+struct RegexNode {
+    NodeKind kind;
+    char symbol;
+    u32 left;
+    u32 right;
+};
+
+/* The nodes are stored in postorder: the children of a node precede it and the root is last */
+template<typename Nodes>
+struct Parser {
+    std::string_view regex;
+    std::string_view alphabet;
+    Nodes nodes;
+    usize pos = 0;
+    usize depth = 0;
+    const char* error = nullptr;
+};
+
+struct NFAFragment {
+    usize start;
+    usize finish;
+};
+
+struct Edge {
+    u32 src;
+    u32 dest;
+    char symbol;
+};
+
+/* The states of the λ-NFA are 0..size - 1, the root fragment holds its start and final */
+template<typename Edges>
+struct ThompsonNFA {
+    Edges edges;
+    usize size;
+    NFAFragment root;
+};
+
+/* Functions declarations */
+constexpr bool is_unary(char);
+template<typename Nodes>
+constexpr u32 add_node(Parser<Nodes>&, RegexNode);
+template<typename Nodes>
+constexpr std::optional<u32> parse_error(Parser<Nodes>&, const char*);
+template<typename Nodes>
+constexpr std::optional<u32> parse_atom(Parser<Nodes>&);
+template<typename Nodes>
+constexpr std::optional<u32> parse_concat(Parser<Nodes>&);
+template<typename Nodes>
+constexpr std::optional<u32> parse_union(Parser<Nodes>&);
+template<typename Nodes>
+constexpr std::optional<u32> parse_regex(Parser<Nodes>&);
+template<typename Edges, typename Fragments>
+constexpr ThompsonNFA<Edges> get_thompson_nfa(std::span<const RegexNode>, Edges, Fragments);
+
+/* Functions definitions */
+constexpr bool
+is_unary(const char c)
+{
+    return c == OP_KLEENE || c == OP_PLUS || c == OP_OPT;
+}
+
+template<typename Nodes>
+constexpr u32
+add_node(Parser<Nodes>& p, const RegexNode node)
+{
+    p.nodes.push_back(node);
+    return u32(p.nodes.size() - 1);
+}
+
+template<typename Nodes>
+constexpr std::optional<u32>
+parse_error(Parser<Nodes>& p, const char* error)
+{
+    p.error = error;
+    return std::nullopt;
+}
+
+template<typename Nodes>
+constexpr std::optional<u32>
+parse_atom(Parser<Nodes>& p)
+{
+    /* atom := symbol | '(' union ')', followed by any number of unary operators */
+
+    if (p.pos == p.regex.size())
+        return parse_error(p, "unexpected end of regex");
+
+    const char token = p.regex[p.pos];
+    std::optional<u32> atom;
+    if (token == '(') {
+        if (++p.depth > MAX_NESTING)
+            return parse_error(p, "parentheses nested too deeply");
+
+        ++p.pos;
+        atom = parse_union(p);
+        if (!atom)
+            return std::nullopt;
+        if (p.pos == p.regex.size() || p.regex[p.pos] != ')')
+            return parse_error(p, "expected ')'");
+
+        ++p.pos;
+        --p.depth;
+    } else if (p.alphabet.find(token) != p.alphabet.npos) {
+        atom = add_node(p, {NodeKind::SYMBOL, token, 0, 0});
+        ++p.pos;
+    } else {
+        return parse_error(p, "expected a symbol or '('");
+    }
+
+    while (p.pos < p.regex.size() && is_unary(p.regex[p.pos])) {
+        const char op = p.regex[p.pos++];
+        const auto kind = op == OP_KLEENE ? NodeKind::STAR
+                          : op == OP_PLUS ? NodeKind::PLUS
+                                          : NodeKind::OPT;
+        atom = add_node(p, {kind, S_LAMBDA, *atom, 0});
+    }
+
+    return atom;
+}
+
+template<typename Nodes>
+constexpr std::optional<u32>
+parse_concat(Parser<Nodes>& p)
+{
+    /* concat := atom atom* */
+
+    auto left = parse_atom(p);
+    while (left && p.pos < p.regex.size() && p.regex[p.pos] != OP_UNION &&
+           p.regex[p.pos] != ')') {
+        const auto right = parse_atom(p);
+        if (!right)
+            return std::nullopt;
+
+        left = add_node(p, {NodeKind::CONCAT, S_LAMBDA, *left, *right});
+    }
+
+    return left;
+}
+
+template<typename Nodes>
+constexpr std::optional<u32>
+parse_union(Parser<Nodes>& p)
+{
+    /* union := concat ('|' concat)* */
+
+    auto left = parse_concat(p);
+    while (left && p.pos < p.regex.size() && p.regex[p.pos] == OP_UNION) {
+        ++p.pos;
+        const auto right = parse_concat(p);
+        if (!right)
+            return std::nullopt;
+
+        left = add_node(p, {NodeKind::UNION, S_LAMBDA, *left, *right});
+    }
+
+    return left;
+}
+
+template<typename Nodes>
+constexpr std::optional<u32>
+parse_regex(Parser<Nodes>& p)
+{
+    /* Parse the regex by recursive descent, in a single pass */
+
+    /* There is a node for every symbol and operator, and for every implicit concatenation */
+    p.nodes.reserve(2 * p.regex.size());
+
+    const auto root = parse_union(p);
+    if (root && p.pos != p.regex.size())
+        return parse_error(p, "unmatched ')'");
+
+    return root;
+}
+
+template<typename Edges, typename Fragments>
+constexpr ThompsonNFA<Edges>
+get_thompson_nfa(const std::span<const RegexNode> ast, Edges edge_list, Fragments fragments)
+{
+    /* Apply Thompson's construction algorithm, the containers come empty from the caller */
+
+    /* Every node adds at most four edges */
+    edge_list.reserve(4 * ast.size());
+    usize size = 0;
+    auto link = [&](usize src, usize dest, char symbol) {
+        edge_list.push_back({u32(src), u32(dest), symbol});
+    };
+
+    /* The NFA fragment of node i is fragments[i] */
+    fragments.reserve(ast.size());
+    for (auto [kind, symbol, left, right] : ast) {
+        usize q, f;
+
+        if (kind == NodeKind::CONCAT || kind == NodeKind::UNION) {
+            auto x = fragments[left];
+            auto y = fragments[right];
+
+            if (kind == NodeKind::CONCAT) {
+                link(x.finish, y.start, S_LAMBDA);
+
+                q = x.start;
+                f = y.finish;
+            } else {
+                q = size++;
+                link(q, x.start, S_LAMBDA);
+                link(q, y.start, S_LAMBDA);
+
+                f = size++;
+
+                link(x.finish, f, S_LAMBDA);
+                link(y.finish, f, S_LAMBDA);
+            }
+        } else if (kind != NodeKind::SYMBOL) {
+            auto x = fragments[left];
+
+            f = size++;
+            q = size++;
+
+            link(q, x.start, S_LAMBDA);
+            if (kind != NodeKind::PLUS)
+                link(q, f, S_LAMBDA);
+            if (kind != NodeKind::OPT)
+                link(x.finish, x.start, S_LAMBDA);
+            link(x.finish, f, S_LAMBDA);
+        } else {
+            f = size++;
+            q = size++;
+            link(q, f, symbol);
+        }
+
+        fragments.push_back({q, f});
+    }
+
+    return {.edges = std::move(edge_list), .size = size, .root = fragments.back()};
+}
+
+} /* namespace rtd */
+
+#endif /* RTD_REGEX_HPP */
@@ -0,0 +1,274 @@
+#ifndef RTD_STATIC_REGEX_HPP
+#define RTD_STATIC_REGEX_HPP
+
+#include <array>
+#include <vector>
+#include <string_view>
+#include <algorithm>
+#include <utility>
+#include <cstdint>
+
+#include "regex.hpp"
+
+/*
+ *  Compile-time version of rtd's pipeline: the regex is parsed and turned
+ *  into a λ-NFA by rtd's own parser and Thompson's construction (regex.hpp),
+ *  then into a DFA with the powerset construction during constant
+ *  evaluation, e.g.
+ *
+ *      static_assert(rtd::static_regex<"(a|b)*abb">::match("abaabb"));
+ *
+ *  The symbols are those of the alphabet, a-z by default as in rtd, and the
+ *  second template argument plays the part of -s, e.g.
+ *  static_regex<"A1|b2", "12ABab">. An invalid regex does not compile.
+ *  It does not follow rtd on these points:
+ *
+ *    - Parentheses are capped at rtd's nesting depth, but the compiler's
+ *      constexpr limits (-fconstexpr-ops-limit, -fconstexpr-depth) may stop
+ *      a large regex first.
+ *    - Only Thompson's construction is used, the AST is not simplified and
+ *      the DFA is not minimized, so num_states() may differ from rtd's.
+ *    - match() only checks whole inputs, there is no search, line mode,
+ *      lazy DFA, JIT or cache.
+ *
+ *  static_regex_test.cpp holds the checks built by `make static_regex_test`.
+ *  Needs a standard library with constexpr std::vector (GCC >= 12 or
+ *  Clang >= 16).
+ */
+
+namespace rtd {
+
+namespace detail {
+
+/* Typedefs */
+/* clang-format off */
+using u64 = uint64_t;
+
+/* Constants */
+inline constexpr usize NUM_CHARS = 1 << 8;
+inline constexpr usize WORD_BITS = 64;
+/* clang-format on */
+
+/* Structs */
+/* Compressed sparse row layout: the edges of state u are at offsets[u]..offsets[u + 1] */
+struct Graph {
+    std::vector<usize> offsets;
+    std::vector<u32> dests;
+    std::vector<char> symbols;
+    u32 start;
+    u32 final;
+};
+
+/* Transitions of state s through class c are at next[s * num_classes + c] */
+struct DFA {
+    std::array<u8, NUM_CHARS> class_of; /* Class 0 holds the bytes that are not in the regex */
+    usize num_classes;
+    std::vector<u32> next; /* The dead state is the number of states */
+    std::vector<u8> accept;
+};
+
+template<usize S, usize K>
+struct StaticDFA {
+    std::array<u8, NUM_CHARS> class_of;
+    std::array<u32, S * K> next;
+    std::array<u8, S> accept;
+};
+
+/* Functions declarations */
+inline void invalid_regex(const char*);
+constexpr Graph get_nfa_graph(std::string_view, std::string_view);
+constexpr void add_closure(const Graph&, std::vector<u64>&);
+constexpr DFA get_dfa(std::string_view, std::string_view);
+
+/* Functions definitions */
+inline void
+invalid_regex(const char*)
+{
+    /* Not constexpr: reaching this during constant evaluation is a compile error */
+}
+
+constexpr Graph
+get_nfa_graph(const std::string_view regex, const std::string_view alphabet)
+{
+    /* Parse the regex and apply Thompson's construction as rtd does, then lay out the edges */
+
+    Parser<std::vector<RegexNode>> p{.regex = regex, .alphabet = alphabet, .nodes = {}};
+    if (!parse_regex(p))
+        invalid_regex(p.error);
+
+    const auto nfa =
+        get_thompson_nfa(p.nodes, std::vector<Edge>(), std::vector<NFAFragment>());
+
+    /* Group the edges by source state with a counting sort */
+    Graph g{.offsets = std::vector<usize>(nfa.size + 1),
+            .dests = std::vector<u32>(nfa.edges.size()),
+            .symbols = std::vector<char>(nfa.edges.size()),
+            .start = u32(nfa.root.start),
+            .final = u32(nfa.root.finish)};
+    for (auto& e : nfa.edges)
+        ++g.offsets[e.src + 1];
+    for (usize u = 0; u < nfa.size; ++u)
+        g.offsets[u + 1] += g.offsets[u];
+
+    auto fill = g.offsets;
+    for (auto [src, dest, symbol] : nfa.edges) {
+        g.dests[fill[src]] = dest;
+        g.symbols[fill[src]++] = symbol;
+    }
+
+    return g;
+}
+
+constexpr void
+add_closure(const Graph& nfa, std::vector<u64>& subset)
+{
+    /* Add the states reachable through λ-transitions to the subset */
+
+    std::vector<u32> pending;
+    for (usize u = 0; u < subset.size() * WORD_BITS; ++u) {
+        if ((subset[u / WORD_BITS] >> (u % WORD_BITS)) & 1)
+            pending.push_back(u32(u));
+    }
+
+    while (!pending.empty()) {
+        const u32 u = pending.back();
+        pending.pop_back();
+
+        for (usize e = nfa.offsets[u]; e < nfa.offsets[u + 1]; ++e) {
+            const u32 v = nfa.dests[e];
+            if (nfa.symbols[e] != S_LAMBDA || ((subset[v / WORD_BITS] >> (v % WORD_BITS)) & 1))
+                continue;
+
+            subset[v / WORD_BITS] |= u64(1) << (v % WORD_BITS);
+            pending.push_back(v);
+        }
+    }
+}
+
+constexpr DFA
+get_dfa(const std::string_view regex, const std::string_view alphabet)
+{
+    /* Apply the powerset construction, closing every subset under λ-transitions */
+
+    const auto nfa = get_nfa_graph(regex, alphabet);
+    const usize words = (nfa.offsets.size() - 1 + WORD_BITS - 1) / WORD_BITS;
+
+    DFA dfa{};
+    std::vector<char> symbols;
+    for (char c : regex) {
+        if (alphabet.find(c) != alphabet.npos && !dfa.class_of[u8(c)]) {
+            dfa.class_of[u8(c)] = u8(symbols.size() + 1);
+            symbols.push_back(c);
+        }
+    }
+    dfa.num_classes = symbols.size() + 1;
+
+    /* Subsets are found by a linear search, which is cheap enough for fixed patterns */
+    std::vector<std::vector<u64>> subsets(1, std::vector<u64>(words));
+    subsets[0][nfa.start / WORD_BITS] |= u64(1) << (nfa.start % WORD_BITS);
+    add_closure(nfa, subsets[0]);
+
+    std::vector<u32> next;
+    for (usize src = 0; src < subsets.size(); ++src) {
+        /* Bytes that are not in the regex lead to the dead state, patched below */
+        next.push_back(u32(-1));
+
+        for (char symbol : symbols) {
+            std::vector<u64> dest(words);
+            bool empty = true;
+            for (usize u = 0; u < words * WORD_BITS; ++u) {
+                if (!((subsets[src][u / WORD_BITS] >> (u % WORD_BITS)) & 1))
+                    continue;
+
+                for (usize e = nfa.offsets[u]; e < nfa.offsets[u + 1]; ++e) {
+                    if (nfa.symbols[e] == symbol) {
+                        dest[nfa.dests[e] / WORD_BITS] |= u64(1) << (nfa.dests[e] % WORD_BITS);
+                        empty = false;
+                    }
+                }
+            }
+
+            if (empty) {
+                next.push_back(u32(-1));
+                continue;
+            }
+
+            add_closure(nfa, dest);
+            const auto it = std::find(subsets.begin(), subsets.end(), dest);
+            next.push_back(u32(it - subsets.begin()));
+            if (it == subsets.end())
+                subsets.push_back(std::move(dest));
+        }
+    }
+
+    const u32 dead = u32(subsets.size());
+    for (auto& v : next) {
+        if (v == u32(-1))
+            v = dead;
+    }
+
+    dfa.next = std::move(next);
+    for (auto& subset : subsets)
+        dfa.accept.push_back(u8(subset[nfa.final / WORD_BITS] >> (nfa.final % WORD_BITS) & 1));
+
+    return dfa;
+}
+
+} /* namespace detail */
+
+/* Structural type, so that string literals can be template arguments */
+template<usize N>
+struct FixedString {
+    char chars[N];
+
+    constexpr FixedString(const char (&str)[N]) { std::copy_n(str, N, chars); }
+    constexpr std::string_view view() const { return {chars, N - 1}; }
+};
+
+template<FixedString Regex, FixedString Alphabet = "abcdefghijklmnopqrstuvwxyz">
+class static_regex {
+    /* Built twice, since memory allocated during constant evaluation cannot outlive it */
+    static constexpr auto SHAPE = []() {
+        const auto d = detail::get_dfa(Regex.view(), Alphabet.view());
+        return std::pair(d.accept.size(), d.num_classes);
+    }();
+    static constexpr usize S = SHAPE.first;
+    static constexpr usize K = SHAPE.second;
+    static constexpr u32 DEAD = u32(S);
+
+    static constexpr auto dfa = []() {
+        const auto d = detail::get_dfa(Regex.view(), Alphabet.view());
+
+        detail::StaticDFA<S, K> result{};
+        result.class_of = d.class_of;
+        std::copy(d.next.begin(), d.next.end(), result.next.begin());
+        std::copy(d.accept.begin(), d.accept.end(), result.accept.begin());
+
+        return result;
+    }();
+
+public:
+    static constexpr usize
+    num_states()
+    {
+        return S;
+    }
+
+    static constexpr bool
+    match(const std::string_view input)
+    {
+        /* A byte costs two loads, its class and the row of the state in the table */
+        u32 state = 0;
+        for (char c : input) {
+            state = dfa.next[state * K + dfa.class_of[u8(c)]];
+            if (state == DEAD)
+                return false;
+        }
+
+        return dfa.accept[state];
+    }
+};
+
+} /* namespace rtd */
+
+#endif /* RTD_STATIC_REGEX_HPP */
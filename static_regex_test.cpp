@@ -0,0 +1,42 @@
+/* Compile-time checks of static_regex.hpp, built by `make static_regex_test` */
+
+#include "static_regex.hpp"
+
+using rtd::static_regex;
+
+/* Concatenation and union */
+static_assert(static_regex<"abc">::match("abc"));
+static_assert(!static_regex<"abc">::match("ab"));
+static_assert(!static_regex<"abc">::match("abcd"));
+static_assert(static_regex<"a|bc">::match("a"));
+static_assert(static_regex<"a|bc">::match("bc"));
+static_assert(!static_regex<"a|bc">::match("ac"));
+
+/* Unary operators */
+static_assert(static_regex<"a*">::match(""));
+static_assert(static_regex<"a*">::match("aaaa"));
+static_assert(!static_regex<"a+">::match(""));
+static_assert(static_regex<"a+">::match("aaa"));
+static_assert(static_regex<"ab?">::match("a"));
+static_assert(static_regex<"ab?">::match("ab"));
+static_assert(!static_regex<"ab?">::match("abb"));
+static_assert(static_regex<"a*?+">::match("aa"));
+
+/* Grouping */
+static_assert(static_regex<"(a|b)*abb">::match("abb"));
+static_assert(static_regex<"(a|b)*abb">::match("abaabb"));
+static_assert(!static_regex<"(a|b)*abb">::match("abab"));
+static_assert(static_regex<"((ab)+|c)?d">::match("ababd"));
+static_assert(static_regex<"((ab)+|c)?d">::match("d"));
+static_assert(!static_regex<"((ab)+|c)?d">::match("abcd"));
+
+/* Bytes outside the regex reject the input */
+static_assert(!static_regex<"a*">::match("aXa"));
+static_assert(!static_regex<"a*">::match(std::string_view("a\0a", 3)));
+
+/* The alphabet is a-z by default, as in rtd, and the second argument replaces it */
+static_assert(static_regex<"A1|b2", "12ABab">::match("A1"));
+static_assert(!static_regex<"A1|b2", "12ABab">::match("b1"));
+static_assert(static_regex<"x(y|z)", "xyz">::match("xz"));
+
+static_assert(static_regex<"a">::num_states() > 0);
@@ -0,0 +1,96 @@
+/*
+ *  Checks that map_dfa_file rejects a DFA file whose checksum is right but
+ *  whose table has an entry that is not a state, built by
+ *  `make dfa_file_test`.
+ */
+
+#define main rtd_main
+#include "../main.cpp"
+#undef main
+
+static bool
+write_words(const char* path, const std::vector<u32>& words)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    const bool written = fwrite(words.data(), sizeof(u32), words.size(), file) == words.size();
+    return fclose(file) == 0 && written;
+}
+
+static bool
+check(const char* path, const std::vector<u32>& words, const char* expected)
+{
+    /* Map the words as a file, and check that it fails with the expected error, if any */
+    if (!write_words(path, words)) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    const char* error = nullptr;
+    auto mapped = map_dfa_file(path, error);
+    if (mapped)
+        unmap_dfa_file(*mapped);
+
+    const bool ok = expected ? !mapped && error && strcmp(error, expected) == 0 : bool(mapped);
+    if (!ok) {
+        fprintf(stderr,
+                "expected '%s', got '%s'\n",
+                expected ? expected : "",
+                error ? error : "");
+    }
+    return ok;
+}
+
+int
+main()
+{
+    const auto nfa = compile_regex(Context{}, "(a|b)*abb", stderr, nullptr);
+    if (!nfa)
+        return EXIT_FAILURE;
+
+    char path[] = "/tmp/rtd_dfa_file_test_XXXXXX";
+    const int fd = mkstemp(path);
+    FILE* file = fd < 0 ? nullptr : fdopen(fd, "wb");
+    if (!file || !write_dfa_file(make_dense_dfa(to_dfa_graph(*nfa)), {}, file)) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    fclose(file);
+
+    const char* error = nullptr;
+    auto mapped = map_dfa_file(path, error);
+    if (!mapped) {
+        fprintf(stderr, "%s: %s\n", path, error);
+        return EXIT_FAILURE;
+    }
+    const auto* data = static_cast<const u32*>(mapped->data);
+    const std::vector<u32> words(data, data + mapped->size / sizeof(u32));
+    unmap_dfa_file(*mapped);
+
+    DFAFileHeader header;
+    std::memcpy(&header, words.data(), sizeof(header));
+    const usize entry = header.table_offset / sizeof(u32) + header.num_classes;
+    const u32 num_entries = header.num_states * header.num_classes;
+
+    /* Change an entry of the table, and write the checksum the file now has */
+    auto corrupt = [&](u32 value) {
+        auto corrupted = words;
+        corrupted[entry] = value;
+        const auto payload = std::span(corrupted).subspan(sizeof(header) / sizeof(u32));
+        auto with_checksum = header;
+        with_checksum.checksum = hash_subset(payload);
+        std::memcpy(corrupted.data(), &with_checksum, sizeof(with_checksum));
+        return corrupted;
+    };
+
+    const bool ok = check(path, words, nullptr) &&
+                    check(path, corrupt(0), nullptr) &&
+                    check(path, corrupt(num_entries), "corrupted DFA file table") &&
+                    check(path, corrupt(UINT32_MAX), "corrupted DFA file table") &&
+                    check(path, corrupt(header.num_classes + 1), "corrupted DFA file table");
+    unlink(path);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}